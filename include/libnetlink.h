@@ -9,6 +9,9 @@
 #include <linux/if_addr.h>
 #include <linux/neighbour.h>
 
+struct rtnl_batch;
+struct rtnl_ring;
+
 struct rtnl_handle
 {
 	int			fd;
@@ -16,6 +19,18 @@ struct rtnl_handle
 	struct sockaddr_nl	peer;
 	__u32			seq;
 	__u32			dump;
+	struct rtnl_batch	*batch;
+	struct rtnl_ring	*ring;
+	/* receive syscalls and messages spent on the last dump */
+	__u32			dump_recvs;
+	__u32			dump_msgs;
+	int			flags;
+#define RTNL_HANDLE_F_FILTERED		0x01	/* last dump filtered by the kernel */
+#define RTNL_HANDLE_F_QUIET		0x02	/* leave dump errors to the caller */
+	/* when set, gets what rtnl_talk() would send without an answer */
+	int			(*capture)(const struct sockaddr_nl *,
+					   struct nlmsghdr *n, void *);
+	void			*capture_arg;
 };
 
 extern int rcvbuf;
@@ -23,8 +38,10 @@ extern int rcvbuf;
 extern int rtnl_open(struct rtnl_handle *rth, unsigned subscriptions);
 extern int rtnl_open_byproto(struct rtnl_handle *rth, unsigned subscriptions, int protocol);
 extern void rtnl_close(struct rtnl_handle *rth);
+extern int rtnl_rx_ring(struct rtnl_handle *rth);
 extern int rtnl_wilddump_request(struct rtnl_handle *rth, int fam, int type);
 extern int rtnl_dump_request(struct rtnl_handle *rth, int type, void *req, int len);
+extern int rtnl_dump_request_n(struct rtnl_handle *rth, struct nlmsghdr *n);
 
 typedef int (*rtnl_filter_t)(const struct sockaddr_nl *,
 			     struct nlmsghdr *n, void *);
@@ -44,6 +61,36 @@ extern int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
 extern int rtnl_send(struct rtnl_handle *rth, const void *buf, int);
 extern int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int);
 
+/* Pipelined requests: while a batch is active, rtnl_talk() without an
+ * answer buffer queues the request and returns at once.  Up to "window"
+ * requests are kept in flight; replies are matched by sequence number
+ * and failures are handed to the report callback together with the tag
+ * that was current when the request was queued (e.g. a batch line).
+ * The callback is responsible for telling the user; without one the
+ * error is printed as rtnl_talk() would.
+ * Anything that needs a reply (dumps, rtnl_talk with answer, listen)
+ * drains the window first.
+ */
+typedef void (*rtnl_batch_report_t)(int tag, int error, void *arg);
+
+struct rtnl_batch_stats
+{
+	unsigned long		requests;
+	unsigned long		failed;
+	unsigned long		sendmsgs;
+	unsigned long		bytes;		/* sent */
+	double			seconds;	/* from start to stop */
+};
+
+extern int rtnl_batch_start(struct rtnl_handle *rth, int window,
+			    rtnl_batch_report_t report, void *arg);
+extern void rtnl_batch_tag(struct rtnl_handle *rth, int tag);
+extern int rtnl_batch_flush(struct rtnl_handle *rth);
+extern void rtnl_batch_stop(struct rtnl_handle *rth,
+			    struct rtnl_batch_stats *stats);
+extern void rtnl_batch_print_stats(FILE *fp,
+				   const struct rtnl_batch_stats *s);
+
 extern int addattr(struct nlmsghdr *n, int maxlen, int type);
 extern int addattr8(struct nlmsghdr *n, int maxlen, int type, __u8 data);
 extern int addattr16(struct nlmsghdr *n, int maxlen, int type, __u16 data);
@@ -71,6 +118,38 @@ extern int __parse_rtattr_nested_compat(struct rtattr *tb[], int max, struct rta
 	({ data = RTA_PAYLOAD(rta) >= len ? RTA_DATA(rta) : NULL;	\
 		__parse_rtattr_nested_compat(tb, max, rta, len); })
 
+/* An attribute table that is kept from one message to the next, for
+ * printers that parse every message of a dump.  A parse clears only the
+ * slots up to the highest one the previous message filled.  Types may
+ * get a policy: the ones the owner has no use for are skipped, and an
+ * attribute with less payload than the minimum registered for its type
+ * is dropped, so that fixed-size payloads can be read without checking
+ * RTA_PAYLOAD again.  The slots are read through t->tb[].  A zeroed
+ * table (e.g. a static one) is ready for rtattr_table_init().
+ */
+#define RTATTR_TABLE_INLINE	64
+#define RTATTR_SKIP		0xffff
+
+struct rtattr_table
+{
+	struct rtattr		**tb;
+	int			max;
+	int			top;		/* highest slot filled */
+	int			policed;
+	__u16			*policy;	/* minimum payload or RTATTR_SKIP */
+	struct rtattr		*tb_inline[RTATTR_TABLE_INLINE];
+	__u16			policy_inline[RTATTR_TABLE_INLINE];
+};
+
+extern int rtattr_table_init(struct rtattr_table *t, int max);
+extern void rtattr_table_free(struct rtattr_table *t);
+extern int rtattr_table_skip(struct rtattr_table *t, int type);
+extern int rtattr_table_minlen(struct rtattr_table *t, int type, int len);
+extern int rtattr_table_parse(struct rtattr_table *t, struct rtattr *rta, int len);
+
+#define rtattr_table_parse_nested(t, rta) \
+	(rtattr_table_parse((t), RTA_DATA(rta), RTA_PAYLOAD(rta)))
+
 static inline __u8 rta_getattr_u8(const struct rtattr *rta)
 {
 	return *(__u8 *)RTA_DATA(rta);
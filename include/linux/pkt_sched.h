@@ -75,7 +75,7 @@ struct tc_estimator {
 
 struct tc_ratespec {
 	unsigned char	cell_log;
-	unsigned char	__reserved;
+	__u8		linklayer; /* lower 4 bits */
 	unsigned short	overhead;
 	short		cell_align;
 	unsigned short	mpu;
@@ -84,6 +84,13 @@ struct tc_ratespec {
 
 #define TC_RTAB_SIZE	1024
 
+enum {
+	TC_LINKLAYER_UNAWARE, /* Indicate unaware old iproute2 util */
+	TC_LINKLAYER_ETHERNET,
+	TC_LINKLAYER_ATM,
+};
+#define TC_LINKLAYER_MASK 0x0F /* limit use to lower 4 bits */
+
 struct tc_sizespec {
 	unsigned char	cell_log;
 	unsigned char	size_log;
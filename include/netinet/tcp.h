@@ -224,6 +224,12 @@ struct tcp_info
   u_int32_t	tcpi_rcv_space;
   u_int32_t	tcpi_total_retrans;
 
+  u_int64_t	tcpi_pacing_rate;
+  u_int64_t	tcpi_max_pacing_rate;
+  u_int64_t	tcpi_bytes_acked;	/* RFC4898 tcpEStatsAppHCThruOctetsAcked */
+  u_int64_t	tcpi_bytes_received;	/* RFC4898 tcpEStatsAppHCThruOctetsReceived */
+  u_int32_t	tcpi_segs_out;		/* RFC4898 tcpEStatsPerfSegsOut */
+  u_int32_t	tcpi_segs_in;		/* RFC4898 tcpEStatsPerfSegsIn */
 };
 
 #endif /* Misc.  */
@@ -146,6 +146,16 @@ int print_timestamp(FILE *fp);
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
+/* Modules linked into the binary, sorted by id */
+struct builtin_kind
+{
+	const char	*id;
+	void		*util;
+};
+
+extern void *find_builtin_kind(const struct builtin_kind *kinds, int n,
+			       const char *id);
+
 extern int cmdlineno;
 extern ssize_t getcmdline(char **line, size_t *len, FILE *in);
 extern int makeargs(char *line, char *argv[], int maxargs);
@@ -6,7 +6,7 @@ LOCAL_SRC_FILES := ip.c ipaddress.c ipaddrlabel.c iproute.c iprule.c ipnetns.c \
         ipmaddr.c ipmonitor.c ipmroute.c ipprefix.c iptuntap.c \
         ipxfrm.c xfrm_state.c xfrm_policy.c xfrm_monitor.c \
         iplink_vlan.c link_veth.c link_gre.c iplink_can.c \
-        iplink_macvlan.c iplink_macvtap.c ipl2tp.c
+        iplink_macvlan.c iplink_macvtap.c ipl2tp.c ipflush.c
 
 LOCAL_MODULE := ip
 
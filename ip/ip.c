@@ -21,6 +21,7 @@
 
 #include "SNAPSHOT.h"
 #include "utils.h"
+#include "ll_map.h"
 #include "ip_common.h"
 
 int preferred_family = AF_UNSPEC;
@@ -33,6 +34,8 @@ char * _SL_ = NULL;
 char *batch_file = NULL;
 int force = 0;
 int max_flush_loops = 10;
+int batch_window = 1;
+int dump_jobs = 1;
 
 struct rtnl_handle rth = { .fd = -1 };
 
@@ -42,7 +45,7 @@ static void usage(void)
 {
 	fprintf(stderr,
 "Usage: ip [ OPTIONS ] OBJECT { COMMAND | help }\n"
-"       ip [ -force ] -batch filename\n"
+"       ip [ -force ] [ -window N ] -batch filename\n"
 "where  OBJECT := { link | addr | addrlabel | route | rule | neigh | ntable |\n"
 "                   tunnel | tuntap | maddr | mroute | mrule | monitor | xfrm |\n"
 "                   netns | l2tp }\n"
@@ -50,7 +53,7 @@ static void usage(void)
 "                    -f[amily] { inet | inet6 | ipx | dnet | link } |\n"
 "                    -l[oops] { maximum-addr-flush-attempts } |\n"
 "                    -o[neline] | -t[imestamp] | -b[atch] [filename] |\n"
-"                    -rc[vbuf] [size]}\n");
+"                    -rc[vbuf] [size] | -j[obs] N }\n");
 	exit(-1);
 }
 
@@ -87,26 +90,66 @@ static const struct cmd {
 	{ 0,		0 }
 };
 
-static int do_cmd(const char *argv0, int argc, char **argv)
+static const struct cmd *find_cmd(const char *argv0)
 {
 	const struct cmd *c;
 
 	for (c = cmds; c->cmd; ++c) {
-		if (matches(argv0, c->cmd) == 0) {
-			return -(c->func(argc-1, argv+1));
-		}
+		if (matches(argv0, c->cmd) == 0)
+			return c;
 	}
+	return NULL;
+}
+
+static int do_cmd(const char *argv0, int argc, char **argv)
+{
+	const struct cmd *c = find_cmd(argv0);
+
+	if (c)
+		return -(c->func(argc-1, argv+1));
 
 	fprintf(stderr, "Object \"%s\" is unknown, try \"ip help\".\n", argv0);
 	return EXIT_FAILURE;
 }
 
 #ifndef ANDROID
+static const char *batch_name;
+static int batch_failed;
+
+static void batch_report(int lineno, int error, void *arg)
+{
+	fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+	fprintf(stderr, "Command failed %s:%d\n", batch_name, lineno);
+	batch_failed = 1;
+}
+
+/* Commands bail out with exit() on bad arguments; make sure the
+ * lines queued before that still reach the kernel.
+ */
+static void batch_exit(void)
+{
+	if (rth.batch)
+		rtnl_batch_flush(&rth);
+}
+
+/* Objects whose commands only talk to the kernel through rth, so that
+ * their requests may stay in flight while later lines are parsed.
+ * Everything else (ioctl, other sockets) waits for the window to drain.
+ */
+static int batch_can_pipeline(const char *argv0)
+{
+	const struct cmd *c = find_cmd(argv0);
+
+	return c && (c->func == do_ipaddr || c->func == do_iproute ||
+		     c->func == do_iprule || c->func == do_ipneigh);
+}
+
 static int batch(const char *name)
 {
 	char *line = NULL;
 	size_t len = 0;
 	int ret = EXIT_SUCCESS;
+	struct rtnl_batch_stats stats;
 
 	if (name && strcmp(name, "-") != 0) {
 		if (freopen(name, "r", stdin) == NULL) {
@@ -121,6 +164,18 @@ static int batch(const char *name)
 		return EXIT_FAILURE;
 	}
 
+	/* Follow link changes made by earlier lines (or anyone else) */
+	ll_map_watch();
+
+	batch_name = name;
+	if (batch_window > 1) {
+		if (rtnl_batch_start(&rth, batch_window, batch_report, NULL) < 0) {
+			rtnl_close(&rth);
+			return EXIT_FAILURE;
+		}
+		atexit(batch_exit);
+	}
+
 	cmdlineno = 0;
 	while (getcmdline(&line, &len, stdin) != -1) {
 		char *largv[100];
@@ -130,16 +185,39 @@ static int batch(const char *name)
 		if (largc == 0)
 			continue;	/* blank line */
 
+		ll_map_sync();
+
+		if (rth.batch && !batch_can_pipeline(largv[0]) &&
+		    rtnl_batch_flush(&rth) < 0) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+		if (batch_failed && !force)
+			break;
+
+		rtnl_batch_tag(&rth, cmdlineno);
 		if (do_cmd(largv[0], largc, largv)) {
 			fprintf(stderr, "Command failed %s:%d\n", name, cmdlineno);
 			ret = EXIT_FAILURE;
 			if (!force)
 				break;
 		}
+		if (batch_failed && !force)
+			break;
 	}
 	if (line)
 		free(line);
 
+	if (rth.batch) {
+		if (rtnl_batch_flush(&rth) < 0)
+			ret = EXIT_FAILURE;
+		rtnl_batch_stop(&rth, &stats);
+		if (show_stats)
+			rtnl_batch_print_stats(stderr, &stats);
+	}
+	if (batch_failed)
+		ret = EXIT_FAILURE;
+
 	rtnl_close(&rth);
 	return ret;
 }
@@ -227,6 +305,28 @@ int main(int argc, char **argv)
 			if (argc <= 1)
 				usage();
 			batch_file = argv[1];
+		} else if (matches(opt, "-window") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			if (get_integer(&batch_window, argv[1], 0) ||
+			    batch_window < 1) {
+				fprintf(stderr, "Invalid batch window '%s'\n",
+					argv[1]);
+				exit(-1);
+			}
+		} else if (matches(opt, "-jobs") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			if (get_integer(&dump_jobs, argv[1], 0) ||
+			    dump_jobs < 1) {
+				fprintf(stderr, "Invalid number of jobs '%s'\n",
+					argv[1]);
+				exit(-1);
+			}
 #endif
 		} else if (matches(opt, "-rcvbuf") == 0) {
 			unsigned int size;
@@ -43,6 +43,12 @@ extern int do_netns(int argc, char **argv);
 extern int do_xfrm(int argc, char **argv);
 extern int do_ipl2tp(int argc, char **argv);
 
+extern int flush_add(struct nlmsghdr *n, int type);
+extern int flush_run(struct rtnl_handle *rth, const char *what);
+extern int rtnl_dump_parallel(const int *families, int nfamilies,
+			      int (*request)(struct rtnl_handle *rth, int family),
+			      rtnl_filter_t filter, int jobs, FILE *out);
+
 static inline int rtm_get_table(struct rtmsg *r, struct rtattr **tb)
 {
 	__u32 table = r->rtm_table;
@@ -52,6 +58,7 @@ static inline int rtm_get_table(struct rtmsg *r, struct rtattr **tb)
 }
 
 extern struct rtnl_handle rth;
+extern int dump_jobs;
 
 struct link_util
 {
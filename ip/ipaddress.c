@@ -12,6 +12,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <syslog.h>
 #include <inttypes.h>
@@ -47,9 +48,7 @@ static struct
 	int up;
 	char *label;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	int flush;
 	int group;
 } filter;
 
@@ -357,12 +356,42 @@ static void print_link_stats(FILE *fp, const struct rtnl_link_stats *s)
 	}
 }
 
+/* Statistics and the link type are skipped unless -s or -d asks for them */
+static struct rtattr_table link_table;
+
+static struct rtattr **link_table_get(void)
+{
+	struct rtattr_table *t = &link_table;
+
+	if (t->tb)
+		return t->tb;
+	if (rtattr_table_init(t, IFLA_MAX) < 0)
+		return NULL;
+	rtattr_table_minlen(t, IFLA_MTU, sizeof(__u32));
+	rtattr_table_minlen(t, IFLA_LINK, sizeof(__u32));
+	rtattr_table_minlen(t, IFLA_MASTER, sizeof(__u32));
+	rtattr_table_minlen(t, IFLA_TXQLEN, sizeof(__u32));
+	rtattr_table_minlen(t, IFLA_GROUP, sizeof(__u32));
+	rtattr_table_minlen(t, IFLA_NUM_VF, sizeof(__u32));
+	rtattr_table_minlen(t, IFLA_OPERSTATE, sizeof(__u8));
+	rtattr_table_minlen(t, IFLA_LINKMODE, sizeof(__u8));
+	rtattr_table_minlen(t, IFLA_STATS, sizeof(struct rtnl_link_stats));
+	rtattr_table_minlen(t, IFLA_STATS64, sizeof(struct rtnl_link_stats64));
+	if (!show_stats) {
+		rtattr_table_skip(t, IFLA_STATS);
+		rtattr_table_skip(t, IFLA_STATS64);
+	}
+	if (!show_details)
+		rtattr_table_skip(t, IFLA_LINKINFO);
+	return t->tb;
+}
+
 int print_linkinfo(const struct sockaddr_nl *who,
 		   struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE*)arg;
 	struct ifinfomsg *ifi = NLMSG_DATA(n);
-	struct rtattr * tb[IFLA_MAX+1];
+	struct rtattr **tb;
 	int len = n->nlmsg_len;
 	unsigned m_flag = 0;
 
@@ -378,7 +407,12 @@ int print_linkinfo(const struct sockaddr_nl *who,
 	if (filter.up && !(ifi->ifi_flags&IFF_UP))
 		return 0;
 
-	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+	tb = link_table_get();
+	if (tb == NULL) {
+		perror("Cannot allocate attribute table");
+		return -1;
+	}
+	rtattr_table_parse(&link_table, IFLA_RTA(ifi), len);
 	if (tb[IFLA_IFNAME] == NULL) {
 		fprintf(stderr, "BUG: device with ifindex %d has nil ifname\n", ifi->ifi_index);
 	}
@@ -481,16 +515,6 @@ int print_linkinfo(const struct sockaddr_nl *who,
 	return 0;
 }
 
-static int flush_update(void)
-{
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
-		return -1;
-	}
-	filter.flushp = 0;
-	return 0;
-}
-
 static int set_lifetime(unsigned int *lifetime, char *argv)
 {
 	if (strcmp(argv, "forever") == 0)
@@ -522,7 +546,7 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		return -1;
 	}
 
-	if (filter.flushb && n->nlmsg_type != RTM_NEWADDR)
+	if (filter.flush && n->nlmsg_type != RTM_NEWADDR)
 		return 0;
 
 	parse_rtattr(rta_tb, IFA_MAX, IFA_RTA(ifa), n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa)));
@@ -562,18 +586,9 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	if (filter.family && filter.family != ifa->ifa_family)
 		return 0;
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
-				return -1;
-		}
-		fn = (struct nlmsghdr*)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELADDR;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char*)fn) + n->nlmsg_len) - filter.flushb;
+	if (filter.flush) {
+		if (flush_add(n, RTM_DELADDR) < 0)
+			return -1;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -582,7 +597,7 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	if (n->nlmsg_type == RTM_DELADDR)
 		fprintf(fp, "Deleted ");
 
-	if (filter.oneline || filter.flushb)
+	if (filter.oneline || filter.flush)
 		fprintf(fp, "%u: %s", ifa->ifa_index, ll_index_to_name(ifa->ifa_index));
 	if (ifa->ifa_family == AF_INET)
 		fprintf(fp, "    inet ");
@@ -714,12 +729,110 @@ int print_addrinfo_secondary(const struct sockaddr_nl *who, struct nlmsghdr *n,
 struct nlmsg_list
 {
 	struct nlmsg_list *next;
+	struct nlmsg_list *idx_next;	/* chain in the address index */
 	struct nlmsghdr	  h;
 };
 
-static int print_selected_addrinfo(int ifindex, struct nlmsg_list *ainfo, FILE *fp)
+struct nlmsg_chain
+{
+	struct nlmsg_list *head;
+	struct nlmsg_list *tail;
+	int		  count;
+};
+
+/* Dumped messages live in large chunks which are freed all at once,
+ * instead of one malloc per link and address.
+ */
+struct nlmsg_arena
+{
+	struct nlmsg_arena *next;
+	size_t		  size;
+	size_t		  used;
+	char		  data[0];
+};
+
+#define NLMSG_ARENA_CHUNK	(256 * 1024)
+
+static struct nlmsg_arena *nlmsg_arena;
+
+static void *nlmsg_arena_alloc(size_t len)
+{
+	struct nlmsg_arena *a = nlmsg_arena;
+	void *p;
+
+	len = (len + 7) & ~7;
+	if (a == NULL || a->used + len > a->size) {
+		size_t size = len > NLMSG_ARENA_CHUNK ? len : NLMSG_ARENA_CHUNK;
+
+		a = malloc(sizeof(*a) + size);
+		if (a == NULL)
+			return NULL;
+		a->size = size;
+		a->used = 0;
+		a->next = nlmsg_arena;
+		nlmsg_arena = a;
+	}
+	p = a->data + a->used;
+	a->used += len;
+	return p;
+}
+
+static void nlmsg_arena_free(void)
+{
+	while (nlmsg_arena) {
+		struct nlmsg_arena *a = nlmsg_arena;
+
+		nlmsg_arena = a->next;
+		free(a);
+	}
+}
+
+/* Addresses hashed by interface index, so that each link finds its
+ * own addresses without scanning the whole address dump.  Dump order
+ * is kept within a bucket.
+ */
+static struct nlmsg_chain *addr_index;
+static unsigned int addr_index_mask;
+
+static int build_addr_index(struct nlmsg_chain *ainfo, int nlinks)
 {
-	for ( ;ainfo ;  ainfo = ainfo->next) {
+	struct nlmsg_list *a;
+	unsigned int size = 64;
+
+	while (size < nlinks)
+		size <<= 1;
+
+	addr_index = calloc(size, sizeof(*addr_index));
+	if (addr_index == NULL)
+		return -1;
+	addr_index_mask = size - 1;
+
+	for (a = ainfo->head; a; a = a->next) {
+		struct ifaddrmsg *ifa = NLMSG_DATA(&a->h);
+		struct nlmsg_chain *c = &addr_index[ifa->ifa_index & addr_index_mask];
+
+		a->idx_next = NULL;
+		if (c->tail)
+			c->tail->idx_next = a;
+		else
+			c->head = a;
+		c->tail = a;
+	}
+	return 0;
+}
+
+static struct nlmsg_list *addr_index_first(int ifindex)
+{
+	if (addr_index == NULL)
+		return NULL;
+	return addr_index[ifindex & addr_index_mask].head;
+}
+
+static int print_selected_addrinfo(int ifindex, FILE *fp)
+{
+	struct nlmsg_list *ainfo;
+
+	for (ainfo = addr_index_first(ifindex); ainfo; ainfo = ainfo->idx_next) {
 		struct nlmsghdr *n = &ainfo->h;
 		struct ifaddrmsg *ifa = NLMSG_DATA(n);
 
@@ -742,19 +855,22 @@ static int print_selected_addrinfo(int ifindex, struct nlmsg_list *ainfo, FILE *
 static int store_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		       void *arg)
 {
-	struct nlmsg_list **linfo = (struct nlmsg_list**)arg;
+	struct nlmsg_chain *chain = (struct nlmsg_chain *)arg;
 	struct nlmsg_list *h;
-	struct nlmsg_list **lp;
 
-	h = malloc(n->nlmsg_len+sizeof(void*));
+	h = nlmsg_arena_alloc(offsetof(struct nlmsg_list, h) + n->nlmsg_len);
 	if (h == NULL)
 		return -1;
 
 	memcpy(&h->h, n, n->nlmsg_len);
 	h->next = NULL;
 
-	for (lp = linfo; *lp; lp = &(*lp)->next) /* NOTHING */;
-	*lp = h;
+	if (chain->tail)
+		chain->tail->next = h;
+	else
+		chain->head = h;
+	chain->tail = h;
+	chain->count++;
 
 	ll_remember_index(who, n, NULL);
 	return 0;
@@ -762,9 +878,9 @@ static int store_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 
 static int ipaddr_list_or_flush(int argc, char **argv, int flush)
 {
-	struct nlmsg_list *linfo = NULL;
-	struct nlmsg_list *ainfo = NULL;
-	struct nlmsg_list *l, *n;
+	struct nlmsg_chain linfo = { NULL, NULL, 0 };
+	struct nlmsg_chain ainfo = { NULL, NULL, 0 };
+	struct nlmsg_list *l;
 	char *filter_dev = NULL;
 	int no_link = 0;
 
@@ -874,68 +990,43 @@ static int ipaddr_list_or_flush(int argc, char **argv, int flush)
 	}
 
 	if (flush) {
-		int round = 0;
-		char flushb[4096-512];
-
-		filter.flushb = flushb;
-		filter.flushp = 0;
-		filter.flushe = sizeof(flushb);
-
-		while ((max_flush_loops == 0) || (round < max_flush_loops)) {
-			const struct rtnl_dump_filter_arg a[3] = {
-				{
-					.filter = print_addrinfo_secondary,
-					.arg1 = stdout,
-				},
-				{
-					.filter = print_addrinfo_primary,
-					.arg1 = stdout,
-				},
-				{
-					.filter = NULL,
-					.arg1 = NULL,
-				},
-			};
-			if (rtnl_wilddump_request(&rth, filter.family, RTM_GETADDR) < 0) {
-				perror("Cannot send dump request");
-				exit(1);
-			}
-			filter.flushed = 0;
-			if (rtnl_dump_filter_l(&rth, a) < 0) {
-				fprintf(stderr, "Flush terminated\n");
-				exit(1);
-			}
-			if (filter.flushed == 0) {
-flush_done:
-				if (show_stats) {
-					if (round == 0)
-						printf("Nothing to flush.\n");
-					else 
-						printf("*** Flush is complete after %d round%s ***\n", round, round>1?"s":"");
-				}
-				fflush(stdout);
-				return 0;
-			}
-			round++;
-			if (flush_update() < 0)
-				return 1;
-
-			if (show_stats) {
-				printf("\n*** Round %d, deleting %d addresses ***\n", round, filter.flushed);
-				fflush(stdout);
-			}
-
-			/* If we are flushing, and specifying primary, then we
-			 * want to flush only a single round.  Otherwise, we'll
-			 * start flushing secondaries that were promoted to
-			 * primaries.
-			 */
-			if (!(filter.flags & IFA_F_SECONDARY) && (filter.flagmask & IFA_F_SECONDARY))
-				goto flush_done;
+		const struct rtnl_dump_filter_arg a[3] = {
+			{
+				.filter = print_addrinfo_secondary,
+				.arg1 = stdout,
+			},
+			{
+				.filter = print_addrinfo_primary,
+				.arg1 = stdout,
+			},
+			{
+				.filter = NULL,
+				.arg1 = NULL,
+			},
+		};
+
+		filter.flush = 1;
+
+		/* Secondaries are queued ahead of their primaries; ones the
+		 * kernel drops together with a primary count as deleted.
+		 */
+		if (rtnl_wilddump_request(&rth, filter.family, RTM_GETADDR) < 0) {
+			perror("Cannot send dump request");
+			exit(1);
 		}
-		fprintf(stderr, "*** Flush remains incomplete after %d rounds. ***\n", max_flush_loops);
-		fflush(stderr);
-		return 1;
+		filter.flushed = 0;
+		if (rtnl_dump_filter_l(&rth, a) < 0) {
+			fprintf(stderr, "Flush terminated\n");
+			exit(1);
+		}
+		nlmsg_arena_free();
+		if (filter.flushed == 0) {
+			if (show_stats)
+				printf("Nothing to flush.\n");
+			fflush(stdout);
+			return 0;
+		}
+		return flush_run(&rth, "addresses") ? 1 : 0;
 	}
 
 	if (filter.family != AF_PACKET) {
@@ -948,12 +1039,17 @@ flush_done:
 			fprintf(stderr, "Dump terminated\n");
 			exit(1);
 		}
+
+		if (build_addr_index(&ainfo, linfo.count) < 0) {
+			perror("Cannot allocate address index");
+			exit(1);
+		}
 	}
 
 
 	if (filter.family && filter.family != AF_PACKET) {
 		struct nlmsg_list **lp;
-		lp=&linfo;
+		lp=&linfo.head;
 
 		if (filter.oneline)
 			no_link = 1;
@@ -963,7 +1059,7 @@ flush_done:
 			struct ifinfomsg *ifi = NLMSG_DATA(&l->h);
 			struct nlmsg_list *a;
 
-			for (a=ainfo; a; a=a->next) {
+			for (a = addr_index_first(ifi->ifi_index); a; a = a->idx_next) {
 				struct nlmsghdr *n = &a->h;
 				struct ifaddrmsg *ifa = NLMSG_DATA(n);
 
@@ -1010,17 +1106,18 @@ flush_done:
 		}
 	}
 
-	for (l=linfo; l; l = n) {
-		n = l->next;
+	for (l = linfo.head; l; l = l->next) {
 		if (no_link || print_linkinfo(NULL, &l->h, stdout) == 0) {
 			struct ifinfomsg *ifi = NLMSG_DATA(&l->h);
 			if (filter.family != AF_PACKET)
-				print_selected_addrinfo(ifi->ifi_index, ainfo, stdout);
+				print_selected_addrinfo(ifi->ifi_index, stdout);
 		}
 		fflush(stdout);
-		free(l);
 	}
 
+	free(addr_index);
+	addr_index = NULL;
+	nlmsg_arena_free();
 	return 0;
 }
 
@@ -1211,8 +1308,6 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 	if (!scoped && cmd != RTM_DELADDR)
 		req.ifa.ifa_scope = default_scope(&lcl);
 
-	ll_init_map(&rth);
-
 	if ((req.ifa.ifa_index = ll_name_to_index(d)) == 0) {
 		fprintf(stderr, "Cannot find device \"%s\"\n", d);
 		return -1;
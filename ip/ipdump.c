@@ -0,0 +1,276 @@
+/*
+ * ipdump.c		Parallel dumps with ordered output.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "utils.h"
+#include "ip_common.h"
+
+/* Each family is dumped on a handle of its own by a receiver thread,
+ * which cuts the dump into chunks.  Worker threads format the chunks
+ * into memory, and the caller writes them out in dump order: first
+ * every chunk of the first family, then the next family, and so on.
+ * That is the order the kernel uses for an AF_UNSPEC dump, so the
+ * output does not depend on the number of threads.
+ */
+#define DUMP_CHUNK	(128 * 1024)
+
+struct dump_chunk
+{
+	struct dump_chunk	*next;		/* within the source */
+	struct dump_chunk	*work_next;
+	int			len;
+	int			done;
+	char			*out;
+	size_t			outlen;
+	char			data[0];
+};
+
+struct dump_source
+{
+	int			family;
+	struct rtnl_handle	rth;
+	pthread_t		thread;
+	struct dump_chunk	*head;
+	struct dump_chunk	*tail;
+	struct dump_chunk	*cur;
+	int			finished;
+	int			error;
+};
+
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dump_cond = PTHREAD_COND_INITIALIZER;
+static struct dump_chunk *work_head, *work_tail;
+static int receivers;
+static int dump_error;
+static rtnl_filter_t dump_filter;
+static int (*dump_request)(struct rtnl_handle *rth, int family);
+
+static void dump_publish(struct dump_source *src)
+{
+	struct dump_chunk *c = src->cur;
+
+	if (c == NULL)
+		return;
+	src->cur = NULL;
+
+	pthread_mutex_lock(&dump_lock);
+	if (src->tail)
+		src->tail->next = c;
+	else
+		src->head = c;
+	src->tail = c;
+	if (work_tail)
+		work_tail->work_next = c;
+	else
+		work_head = c;
+	work_tail = c;
+	pthread_cond_broadcast(&dump_cond);
+	pthread_mutex_unlock(&dump_lock);
+}
+
+static int dump_collect(const struct sockaddr_nl *who,
+			struct nlmsghdr *n, void *arg)
+{
+	struct dump_source *src = arg;
+	struct rtgenmsg *g = NLMSG_DATA(n);
+	int len = NLMSG_ALIGN(n->nlmsg_len);
+
+	/* A kernel without this family answers with every family */
+	if (n->nlmsg_len >= NLMSG_LENGTH(sizeof(*g)) &&
+	    g->rtgen_family != src->family)
+		return 0;
+
+	if (src->cur && src->cur->len + len > DUMP_CHUNK)
+		dump_publish(src);
+	if (src->cur == NULL) {
+		int size = len > DUMP_CHUNK ? len : DUMP_CHUNK;
+
+		src->cur = calloc(1, sizeof(struct dump_chunk) + size);
+		if (src->cur == NULL) {
+			perror("Cannot allocate dump chunk");
+			return -1;
+		}
+	}
+	memcpy(src->cur->data + src->cur->len, n, n->nlmsg_len);
+	src->cur->len += len;
+	return 0;
+}
+
+static void *dump_receiver(void *arg)
+{
+	struct dump_source *src = arg;
+
+	if (dump_request(&src->rth, src->family) < 0) {
+		perror("Cannot send dump request");
+		src->error = 1;
+	} else if (rtnl_dump_filter(&src->rth, dump_collect, src) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		src->error = 1;
+	}
+	dump_publish(src);
+
+	pthread_mutex_lock(&dump_lock);
+	src->finished = 1;
+	receivers--;
+	pthread_cond_broadcast(&dump_cond);
+	pthread_mutex_unlock(&dump_lock);
+	return NULL;
+}
+
+static void dump_format(struct dump_chunk *c)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	FILE *fp;
+	int off;
+
+	fp = open_memstream(&c->out, &c->outlen);
+	if (fp == NULL) {
+		perror("open_memstream");
+		dump_error = 1;
+		return;
+	}
+	for (off = 0; off < c->len; ) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(c->data + off);
+
+		if (dump_filter(&nladdr, n, fp) < 0) {
+			dump_error = 1;
+			break;
+		}
+		off += NLMSG_ALIGN(n->nlmsg_len);
+	}
+	fclose(fp);
+}
+
+static void *dump_worker(void *arg)
+{
+	for (;;) {
+		struct dump_chunk *c;
+
+		pthread_mutex_lock(&dump_lock);
+		while (work_head == NULL && receivers > 0)
+			pthread_cond_wait(&dump_cond, &dump_lock);
+		c = work_head;
+		if (c == NULL) {
+			pthread_mutex_unlock(&dump_lock);
+			return NULL;
+		}
+		work_head = c->work_next;
+		if (work_head == NULL)
+			work_tail = NULL;
+		pthread_mutex_unlock(&dump_lock);
+
+		dump_format(c);
+
+		pthread_mutex_lock(&dump_lock);
+		c->done = 1;
+		pthread_cond_broadcast(&dump_cond);
+		pthread_mutex_unlock(&dump_lock);
+	}
+}
+
+/* Send "request" for each of the families and run "filter" over the
+ * messages in "jobs" threads.  The filter must be safe to call from
+ * several threads at once and may only write to the stream it gets.
+ */
+int rtnl_dump_parallel(const int *families, int nfamilies,
+		       int (*request)(struct rtnl_handle *rth, int family),
+		       rtnl_filter_t filter, int jobs, FILE *out)
+{
+	struct dump_source *src;
+	pthread_t *workers;
+	int i, nworkers = 0;
+	__u32 recvs = 0, msgs = 0;
+
+	src = calloc(nfamilies, sizeof(*src));
+	workers = calloc(jobs, sizeof(*workers));
+	if (src == NULL || workers == NULL) {
+		perror("rtnl_dump_parallel");
+		exit(1);
+	}
+
+	dump_filter = filter;
+	dump_request = request;
+	dump_error = 0;
+	receivers = 0;
+
+	for (i = 0; i < nfamilies; i++) {
+		src[i].family = families[i];
+		if (rtnl_open(&src[i].rth, 0) < 0)
+			exit(1);
+	}
+	for (i = 0; i < nfamilies; i++) {
+		if (pthread_create(&src[i].thread, NULL, dump_receiver,
+				   &src[i]) != 0) {
+			perror("Cannot start dump thread");
+			exit(1);
+		}
+		receivers++;
+	}
+	for (i = 0; i < jobs; i++) {
+		if (pthread_create(&workers[i], NULL, dump_worker, NULL) != 0)
+			break;
+		nworkers++;
+	}
+	if (nworkers == 0) {
+		perror("Cannot start dump thread");
+		exit(1);
+	}
+
+	for (i = 0; i < nfamilies; i++) {
+		for (;;) {
+			struct dump_chunk *c;
+
+			pthread_mutex_lock(&dump_lock);
+			while (!(src[i].head && src[i].head->done) &&
+			       !(src[i].head == NULL && src[i].finished))
+				pthread_cond_wait(&dump_cond, &dump_lock);
+			c = src[i].head;
+			if (c) {
+				src[i].head = c->next;
+				if (src[i].head == NULL)
+					src[i].tail = NULL;
+			}
+			pthread_mutex_unlock(&dump_lock);
+
+			if (c == NULL)
+				break;
+			fwrite(c->out, 1, c->outlen, out);
+			free(c->out);
+			free(c);
+		}
+	}
+	fflush(out);
+
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	for (i = 0; i < nfamilies; i++) {
+		pthread_join(src[i].thread, NULL);
+		if (src[i].error)
+			dump_error = 1;
+		recvs += src[i].rth.dump_recvs;
+		msgs += src[i].rth.dump_msgs;
+		rtnl_close(&src[i].rth);
+	}
+
+	if (show_stats > 1)
+		fprintf(stderr, "Dumped %u messages in %u receive calls, %d families, %d threads\n",
+			msgs, recvs, nfamilies, nworkers);
+
+	free(workers);
+	free(src);
+	return dump_error ? -1 : 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * ipflush.c		Bulk deletion for "ip {route|addr|neigh} flush".
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "utils.h"
+#include "ip_common.h"
+
+/* The dump only collects the matching objects, turned into delete
+ * requests.  Deleting while the dump is still running makes the kernel
+ * skip entries and forces the whole table to be walked again; here the
+ * requests are streamed afterwards in large pipelined windows, and only
+ * the ones that failed are sent again.
+ */
+#define FLUSH_WINDOW	256
+
+static char *flush_buf;
+static int flush_len;
+static int flush_size;
+static int flush_count;
+
+static int *flush_failed;
+static int flush_nfailed;
+static int flush_maxfailed;
+static int flush_error;
+
+int flush_add(struct nlmsghdr *n, int type)
+{
+	struct nlmsghdr *fn;
+	int len = NLMSG_ALIGN(n->nlmsg_len);
+
+	if (flush_len + len > flush_size) {
+		int size = flush_size ? flush_size * 2 : 65536;
+		char *buf;
+
+		while (size < flush_len + len)
+			size *= 2;
+		buf = realloc(flush_buf, size);
+		if (buf == NULL) {
+			perror("Cannot allocate flush buffer");
+			return -1;
+		}
+		flush_buf = buf;
+		flush_size = size;
+	}
+
+	fn = (struct nlmsghdr *)(flush_buf + flush_len);
+	memcpy(fn, n, n->nlmsg_len);
+	fn->nlmsg_type = type;
+	fn->nlmsg_flags = NLM_F_REQUEST;
+	flush_len += len;
+	flush_count++;
+	return 0;
+}
+
+static void flush_report(int tag, int error, void *arg)
+{
+	/* Taken away by someone else, or together with an earlier entry */
+	if (error == ESRCH || error == ENOENT || error == EADDRNOTAVAIL)
+		return;
+
+	if (flush_nfailed == flush_maxfailed) {
+		int max = flush_maxfailed ? flush_maxfailed * 2 : 256;
+		int *failed = realloc(flush_failed, max * sizeof(int));
+
+		if (failed == NULL)
+			return;
+		flush_failed = failed;
+		flush_maxfailed = max;
+	}
+	flush_failed[flush_nfailed++] = tag;
+	flush_error = error;
+}
+
+static void flush_reset(void)
+{
+	free(flush_buf);
+	free(flush_failed);
+	flush_buf = NULL;
+	flush_failed = NULL;
+	flush_len = flush_size = flush_count = 0;
+	flush_nfailed = flush_maxfailed = 0;
+}
+
+/* Returns the number of entries left behind. */
+int flush_run(struct rtnl_handle *rth, const char *what)
+{
+	struct rtnl_batch *saved = rth->batch;
+	struct timeval start, end;
+	int *pending = NULL;
+	int npending = flush_count;
+	int deleted = 0;
+	int round = 0;
+	int i;
+
+	gettimeofday(&start, NULL);
+
+	/* A batch file may have its own window open; it is empty here,
+	 * since the dump that filled the list had to drain it.
+	 */
+	rth->batch = NULL;
+
+	for (;;) {
+		int off = 0;
+
+		if (rtnl_batch_start(rth, FLUSH_WINDOW, flush_report, NULL) < 0) {
+			flush_error = errno;
+			break;
+		}
+
+		round++;
+		if (show_stats) {
+			printf("\n*** Round %d, deleting %d %s ***\n",
+			       round, npending, what);
+			fflush(stdout);
+		}
+
+		flush_nfailed = 0;
+		for (i = 0; round == 1 ? off < flush_len : i < npending; i++) {
+			struct nlmsghdr *n;
+
+			if (round > 1)
+				off = pending[i];
+			n = (struct nlmsghdr *)(flush_buf + off);
+			rtnl_batch_tag(rth, off);
+			if (rtnl_talk(rth, n, 0, 0, NULL) < 0)
+				flush_report(off, errno, NULL);
+			if (round == 1)
+				off += NLMSG_ALIGN(n->nlmsg_len);
+		}
+		if (rtnl_batch_flush(rth) < 0) {
+			flush_error = errno;
+			rtnl_batch_stop(rth, NULL);
+			break;
+		}
+		rtnl_batch_stop(rth, NULL);
+
+		deleted += npending - flush_nfailed;
+
+		/* The failures become the next round's work list */
+		free(pending);
+		pending = flush_failed;
+		npending = flush_nfailed;
+		flush_failed = NULL;
+		flush_nfailed = flush_maxfailed = 0;
+
+		if (npending == 0 ||
+		    (max_flush_loops && round >= max_flush_loops))
+			break;
+	}
+
+	rth->batch = saved;
+	gettimeofday(&end, NULL);
+
+	if (show_stats) {
+		double secs = (end.tv_sec - start.tv_sec) +
+			(end.tv_usec - start.tv_usec) / 1000000.;
+
+		printf("*** Deleted %d %s in %.3f seconds", deleted, what, secs);
+		if (secs > 0)
+			printf(", %.0f per second", deleted / secs);
+		printf(" ***\n");
+		if (npending == 0)
+			printf("*** Flush is complete after %d round%s ***\n",
+			       round, round > 1 ? "s" : "");
+	}
+	fflush(stdout);
+
+	if (npending)
+		fprintf(stderr, "*** Flush remains incomplete after %d rounds, %d %s remain: %s ***\n",
+			round, npending, what, strerror(flush_error));
+
+	free(pending);
+	flush_reset();
+	return npending;
+}
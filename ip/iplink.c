@@ -100,12 +100,29 @@ static int on_off(char *msg)
 static void *BODY;		/* cached dlopen(NULL) handle */
 static struct link_util *linkutil_list;
 
+#ifndef ANDROID
+/* Link types linked into ip are found without probing for link_*.so */
+#define LINK_KIND(id)	extern struct link_util id##_link_util;
+#include "link_kinds.h"
+
+static const struct builtin_kind builtin_links[] = {
+#define LINK_KIND(id)	{ #id, &id##_link_util },
+#include "link_kinds.h"
+};
+#endif
+
 struct link_util *get_link_kind(const char *id)
 {
 	void *dlh;
 	char buf[256];
 	struct link_util *l;
 
+#ifndef ANDROID
+	l = find_builtin_kind(builtin_links, ARRAY_SIZE(builtin_links), id);
+	if (l)
+		return l;
+#endif
+
 	for (l = linkutil_list; l; l = l->next)
 		if (strcmp(l->id, id) == 0)
 			return l;
@@ -26,7 +26,6 @@
 #include "ip_common.h"
 
 #define NUD_VALID	(NUD_PERMANENT|NUD_NOARP|NUD_REACHABLE|NUD_PROBE|NUD_STALE|NUD_DELAY)
-#define MAX_ROUNDS	10
 
 static struct
 {
@@ -36,9 +35,7 @@ static struct
 	int unused_only;
 	inet_prefix pfx;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	int flush;
 } filter;
 
 static void usage(void) __attribute__((noreturn));
@@ -81,16 +78,6 @@ int nud_state_a2n(unsigned *state, char *arg)
 	return 0;
 }
 
-static int flush_update(void)
-{
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
-		return -1;
-	}
-	filter.flushp = 0;
-	return 0;
-}
-
 
 static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 {
@@ -167,8 +154,6 @@ static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 		addattr_l(&req.n, sizeof(req), NDA_LLADDR, llabuf, l);
 	}
 
-	ll_init_map(&rth);
-
 	if ((req.ndm.ndm_ifindex = ll_name_to_index(d)) == 0) {
 		fprintf(stderr, "Cannot find device \"%s\"\n", d);
 		return -1;
@@ -181,12 +166,14 @@ static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 }
 
 
+static struct rtattr_table neigh_table;
+
 int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE*)arg;
 	struct ndmsg *r = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct rtattr * tb[NDA_MAX+1];
+	struct rtattr **tb = neigh_table.tb;
 	char abuf[256];
 
 	if (n->nlmsg_type != RTM_NEWNEIGH && n->nlmsg_type != RTM_DELNEIGH) {
@@ -201,7 +188,7 @@ int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
-	if (filter.flushb && n->nlmsg_type != RTM_NEWNEIGH)
+	if (filter.flush && n->nlmsg_type != RTM_NEWNEIGH)
 		return 0;
 
 	if (filter.family && filter.family != r->ndm_family)
@@ -214,7 +201,17 @@ int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
              (r->ndm_family != AF_DECnet))
 		return 0;
 
-	parse_rtattr(tb, NDA_MAX, NDA_RTA(r), n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (tb == NULL) {
+		if (rtattr_table_init(&neigh_table, NDA_MAX) < 0) {
+			perror("Cannot allocate attribute table");
+			return -1;
+		}
+		rtattr_table_minlen(&neigh_table, NDA_CACHEINFO,
+				    sizeof(struct nda_cacheinfo));
+		rtattr_table_minlen(&neigh_table, NDA_PROBES, sizeof(__u32));
+		tb = neigh_table.tb;
+	}
+	rtattr_table_parse(&neigh_table, NDA_RTA(r), len);
 
 	if (tb[NDA_DST]) {
 		if (filter.pfx.family) {
@@ -232,18 +229,9 @@ int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 			return 0;
 	}
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
-				return -1;
-		}
-		fn = (struct nlmsghdr*)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELNEIGH;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char*)fn) + n->nlmsg_len) - filter.flushb;
+	if (filter.flush) {
+		if (flush_add(n, RTM_DELNEIGH) < 0)
+			return -1;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -384,45 +372,25 @@ int do_show_or_flush(int argc, char **argv, int flush)
 	}
 
 	if (flush) {
-		int round = 0;
-		char flushb[4096-512];
-
-		filter.flushb = flushb;
-		filter.flushp = 0;
-		filter.flushe = sizeof(flushb);
+		filter.flush = 1;
 		filter.state &= ~NUD_FAILED;
 
-		while (round < MAX_ROUNDS) {
-			if (rtnl_wilddump_request(&rth, filter.family, RTM_GETNEIGH) < 0) {
-				perror("Cannot send dump request");
-				exit(1);
-			}
-			filter.flushed = 0;
-			if (rtnl_dump_filter(&rth, print_neigh, stdout) < 0) {
-				fprintf(stderr, "Flush terminated\n");
-				exit(1);
-			}
-			if (filter.flushed == 0) {
-				if (show_stats) {
-					if (round == 0)
-						printf("Nothing to flush.\n");
-					else
-						printf("*** Flush is complete after %d round%s ***\n", round, round>1?"s":"");
-				}
-				fflush(stdout);
-				return 0;
-			}
-			round++;
-			if (flush_update() < 0)
-				exit(1);
-			if (show_stats) {
-				printf("\n*** Round %d, deleting %d entries ***\n", round, filter.flushed);
-				fflush(stdout);
-			}
+		if (rtnl_wilddump_request(&rth, filter.family, RTM_GETNEIGH) < 0) {
+			perror("Cannot send dump request");
+			exit(1);
+		}
+		filter.flushed = 0;
+		if (rtnl_dump_filter(&rth, print_neigh, stdout) < 0) {
+			fprintf(stderr, "Flush terminated\n");
+			exit(1);
+		}
+		if (filter.flushed == 0) {
+			if (show_stats)
+				printf("Nothing to flush.\n");
+			fflush(stdout);
+			return 0;
 		}
-		printf("*** Flush not complete bailing out after %d rounds\n",
-			MAX_ROUNDS);
-		return 1;
+		return flush_run(&rth, "entries") ? 1 : 0;
 	}
 
 	ndm.ndm_family = filter.family;
@@ -12,6 +12,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <syslog.h>
 #include <fcntl.h>
@@ -95,9 +96,7 @@ static struct
 	int tb;
 	int cloned;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	int flush;
 	int protocol, protocolmask;
 	int scope, scopemask;
 	int type, typemask;
@@ -114,152 +113,244 @@ static struct
 	inet_prefix msrc;
 } filter;
 
-static int flush_update(void)
+/* filter_nlmsg() runs for every route of a dump.  Rather than going
+ * through every field of the filter each time, the filter is compiled
+ * into the list of tests that can reject a route, with the prefix
+ * masks worked out in advance.  The outcome does not depend on the
+ * order of the tests, except that the table test has to see every
+ * route to learn whether IPv6 has multiple tables.
+ */
+enum {
+	RP_TABLE,
+	RP_CLONED,
+	RP_RTM,		/* masked compare of an rtmsg byte */
+	RP_ROOT,	/* route prefix inside the filter prefix */
+	RP_MATCH,	/* route prefix covering the filter address */
+	RP_ADDR,	/* host address inside the filter prefix */
+	RP_U32,		/* masked compare of a u32 attribute, 0 if absent */
+	RP_FLUSH_V6,
+};
+
+struct route_pred
 {
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
-		return -1;
+	int		op;
+	int		attr;
+	int		offset;		/* rtmsg byte for RP_RTM, prefix length otherwise */
+	int		family;
+	int		bits;
+	int		bytes;
+	int		words;
+	int		value;
+	__u32		mask;
+	__u32		addr[4];
+	__u32		amask[4];
+};
+
+#define ROUTE_PREDS_MAX	16
+
+static struct route_pred route_preds[ROUTE_PREDS_MAX];
+static int route_npreds = -1;
+static int ip6_multiple_tables;
+
+static void rp_mask(__u32 *mask, int bits)
+{
+	int i;
+
+	for (i = 0; i < 4; i++, bits -= 32) {
+		if (bits >= 32)
+			mask[i] = ~0U;
+		else if (bits > 0)
+			mask[i] = htonl(~0U << (32 - bits));
+		else
+			mask[i] = 0;
 	}
-	filter.flushp = 0;
-	return 0;
 }
 
-int filter_nlmsg(struct nlmsghdr *n, struct rtattr **tb, int host_len)
+static struct route_pred *rp_add(int op)
 {
-	struct rtmsg *r = NLMSG_DATA(n);
-	inet_prefix dst;
-	inet_prefix src;
-	inet_prefix via;
-	inet_prefix prefsrc;
-	__u32 table;
-	static int ip6_multiple_tables;
-
-	table = rtm_get_table(r, tb);
+	struct route_pred *p = &route_preds[route_npreds++];
 
-	if (r->rtm_family == AF_INET6 && table != RT_TABLE_MAIN)
-		ip6_multiple_tables = 1;
+	memset(p, 0, sizeof(*p));
+	p->op = op;
+	return p;
+}
 
-	if (filter.cloned == !(r->rtm_flags&RTM_F_CLONED))
-		return 0;
+static void rp_add_rtm(int offset, int value, int mask)
+{
+	struct route_pred *p;
+
+	if ((mask & 0xFF) == 0)
+		return;
+	p = rp_add(RP_RTM);
+	p->offset = offset;
+	p->value = value & 0xFF;
+	p->mask = mask & 0xFF;
+}
 
-	if (r->rtm_family == AF_INET6 && !ip6_multiple_tables) {
-		if (filter.tb) {
-			if (filter.tb == RT_TABLE_LOCAL) {
-				if (r->rtm_type != RTN_LOCAL)
-					return 0;
-			} else if (filter.tb == RT_TABLE_MAIN) {
-				if (r->rtm_type == RTN_LOCAL)
-					return 0;
-			} else {
-				return 0;
-			}
-		}
-	} else {
-		if (filter.tb > 0 && filter.tb != table)
-			return 0;
-	}
-	if ((filter.protocol^r->rtm_protocol)&filter.protocolmask)
-		return 0;
-	if ((filter.scope^r->rtm_scope)&filter.scopemask)
-		return 0;
-	if ((filter.type^r->rtm_type)&filter.typemask)
-		return 0;
-	if ((filter.tos^r->rtm_tos)&filter.tosmask)
-		return 0;
-	if (filter.rdst.family &&
-	    (r->rtm_family != filter.rdst.family || filter.rdst.bitlen > r->rtm_dst_len))
-		return 0;
-	if (filter.mdst.family &&
-	    (r->rtm_family != filter.mdst.family ||
-	     (filter.mdst.bitlen >= 0 && filter.mdst.bitlen < r->rtm_dst_len)))
-		return 0;
-	if (filter.rsrc.family &&
-	    (r->rtm_family != filter.rsrc.family || filter.rsrc.bitlen > r->rtm_src_len))
-		return 0;
-	if (filter.msrc.family &&
-	    (r->rtm_family != filter.msrc.family ||
-	     (filter.msrc.bitlen >= 0 && filter.msrc.bitlen < r->rtm_src_len)))
-		return 0;
-	if (filter.rvia.family && r->rtm_family != filter.rvia.family)
-		return 0;
-	if (filter.rprefsrc.family && r->rtm_family != filter.rprefsrc.family)
-		return 0;
+static void rp_add_u32(int attr, __u32 value, __u32 mask)
+{
+	struct route_pred *p;
+
+	if (mask == 0)
+		return;
+	p = rp_add(RP_U32);
+	p->attr = attr;
+	p->value = value;
+	p->mask = mask;
+}
 
-	memset(&dst, 0, sizeof(dst));
-	dst.family = r->rtm_family;
-	if (tb[RTA_DST])
-		memcpy(&dst.data, RTA_DATA(tb[RTA_DST]), (r->rtm_dst_len+7)/8);
-	if (filter.rsrc.family || filter.msrc.family) {
-		memset(&src, 0, sizeof(src));
-		src.family = r->rtm_family;
-		if (tb[RTA_SRC])
-			memcpy(&src.data, RTA_DATA(tb[RTA_SRC]), (r->rtm_src_len+7)/8);
-	}
-	if (filter.rvia.bitlen>0) {
-		memset(&via, 0, sizeof(via));
-		via.family = r->rtm_family;
-		if (tb[RTA_GATEWAY])
-			memcpy(&via.data, RTA_DATA(tb[RTA_GATEWAY]), host_len/8);
+static void rp_add_prefix(int op, int attr, int offset, const inet_prefix *pfx)
+{
+	struct route_pred *p;
+	int i;
+
+	if (pfx->family == 0)
+		return;
+	p = rp_add(op);
+	p->attr = attr;
+	p->offset = offset;
+	p->family = pfx->family;
+	p->bits = pfx->bitlen;
+	if (op == RP_MATCH) {
+		memcpy(p->addr, pfx->data, sizeof(p->addr));
+		return;
 	}
-	if (filter.rprefsrc.bitlen>0) {
-		memset(&prefsrc, 0, sizeof(prefsrc));
-		prefsrc.family = r->rtm_family;
-		if (tb[RTA_PREFSRC])
-			memcpy(&prefsrc.data, RTA_DATA(tb[RTA_PREFSRC]), host_len/8);
+	if (p->bits > 128)
+		p->bits = 128;
+	if (p->bits > 0) {
+		p->bytes = (p->bits + 7) / 8;
+		p->words = (p->bits + 31) / 32;
 	}
+	rp_mask(p->amask, p->bits);
+	for (i = 0; i < 4; i++)
+		p->addr[i] = pfx->data[i] & p->amask[i];
+}
 
-	if (filter.rdst.family && inet_addr_match(&dst, &filter.rdst, filter.rdst.bitlen))
-		return 0;
-	if (filter.mdst.family && filter.mdst.bitlen >= 0 &&
-	    inet_addr_match(&dst, &filter.mdst, r->rtm_dst_len))
-		return 0;
+static void filter_compile(void)
+{
+	route_npreds = 0;
+	if (filter.tb)
+		rp_add(RP_TABLE)->value = filter.tb;
+	if (filter.cloned != 2)
+		rp_add(RP_CLONED)->value = filter.cloned;
+	rp_add_rtm(offsetof(struct rtmsg, rtm_protocol), filter.protocol, filter.protocolmask);
+	rp_add_rtm(offsetof(struct rtmsg, rtm_scope), filter.scope, filter.scopemask);
+	rp_add_rtm(offsetof(struct rtmsg, rtm_type), filter.type, filter.typemask);
+	rp_add_rtm(offsetof(struct rtmsg, rtm_tos), filter.tos, filter.tosmask);
+	rp_add_prefix(RP_ROOT, RTA_DST, offsetof(struct rtmsg, rtm_dst_len), &filter.rdst);
+	rp_add_prefix(RP_MATCH, RTA_DST, offsetof(struct rtmsg, rtm_dst_len), &filter.mdst);
+	rp_add_prefix(RP_ROOT, RTA_SRC, offsetof(struct rtmsg, rtm_src_len), &filter.rsrc);
+	rp_add_prefix(RP_MATCH, RTA_SRC, offsetof(struct rtmsg, rtm_src_len), &filter.msrc);
+	rp_add_prefix(RP_ADDR, RTA_GATEWAY, 0, &filter.rvia);
+	rp_add_prefix(RP_ADDR, RTA_PREFSRC, 0, &filter.rprefsrc);
+	rp_add_u32(RTA_FLOW, filter.realm, filter.realmmask);
+	rp_add_u32(RTA_IIF, filter.iif, filter.iifmask);
+	rp_add_u32(RTA_OIF, filter.oif, filter.oifmask);
+	rp_add_u32(RTA_MARK, filter.mark, filter.markmask);
+	if (filter.flush)
+		rp_add(RP_FLUSH_V6);
+}
 
-	if (filter.rsrc.family && inet_addr_match(&src, &filter.rsrc, filter.rsrc.bitlen))
-		return 0;
-	if (filter.msrc.family && filter.msrc.bitlen >= 0 &&
-	    inet_addr_match(&src, &filter.msrc, r->rtm_src_len))
-		return 0;
+static void rp_load(__u32 *w, const struct rtattr *rta, int len)
+{
+	memset(w, 0, 4 * sizeof(__u32));
+	if (rta == NULL)
+		return;
+	if (len > RTA_PAYLOAD(rta))
+		len = RTA_PAYLOAD(rta);
+	if (len > 4 * sizeof(__u32))
+		len = 4 * sizeof(__u32);
+	memcpy(w, RTA_DATA(rta), len);
+}
 
-	if (filter.rvia.family && inet_addr_match(&via, &filter.rvia, filter.rvia.bitlen))
-		return 0;
-	if (filter.rprefsrc.family && inet_addr_match(&prefsrc, &filter.rprefsrc, filter.rprefsrc.bitlen))
+static int rp_table(const struct route_pred *p, struct rtmsg *r,
+		    struct rtattr **tb)
+{
+	__u32 table = rtm_get_table(r, tb);
+
+	if (r->rtm_family == AF_INET6 && table != RT_TABLE_MAIN)
+		ip6_multiple_tables = 1;
+
+	if (r->rtm_family == AF_INET6 && !ip6_multiple_tables) {
+		if (p->value == RT_TABLE_LOCAL)
+			return r->rtm_type == RTN_LOCAL;
+		if (p->value == RT_TABLE_MAIN)
+			return r->rtm_type != RTN_LOCAL;
 		return 0;
-	if (filter.realmmask) {
-		__u32 realms = 0;
-		if (tb[RTA_FLOW])
-			realms = rta_getattr_u32(tb[RTA_FLOW]);
-		if ((realms^filter.realm)&filter.realmmask)
-			return 0;
-	}
-	if (filter.iifmask) {
-		int iif = 0;
-		if (tb[RTA_IIF])
-			iif = *(int*)RTA_DATA(tb[RTA_IIF]);
-		if ((iif^filter.iif)&filter.iifmask)
-			return 0;
 	}
-	if (filter.oifmask) {
-		int oif = 0;
-		if (tb[RTA_OIF])
-			oif = *(int*)RTA_DATA(tb[RTA_OIF]);
-		if ((oif^filter.oif)&filter.oifmask)
-			return 0;
-	}
-	if (filter.markmask) {
-		int mark = 0;
-		if (tb[RTA_MARK])
-			mark = *(int *)RTA_DATA(tb[RTA_MARK]);
-		if ((mark ^ filter.mark) & filter.markmask)
-			return 0;
-	}
-	if (filter.flushb &&
-	    r->rtm_family == AF_INET6 &&
-	    r->rtm_dst_len == 0 &&
-	    r->rtm_type == RTN_UNREACHABLE &&
-	    tb[RTA_PRIORITY] &&
-	    *(int*)RTA_DATA(tb[RTA_PRIORITY]) == -1)
-		return 0;
+	return p->value < 0 || p->value == table;
+}
+
+int filter_nlmsg(struct nlmsghdr *n, struct rtattr **tb, int host_len)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	const struct route_pred *p;
+	__u32 w[4];
+	int i, len;
+
+	if (route_npreds < 0)
+		filter_compile();
+
+	for (p = route_preds; p < route_preds + route_npreds; p++) {
+		switch (p->op) {
+		case RP_TABLE:
+			if (!rp_table(p, r, tb))
+				return 0;
+			break;
+		case RP_CLONED:
+			if (p->value == !(r->rtm_flags&RTM_F_CLONED))
+				return 0;
+			break;
+		case RP_RTM:
+			if ((((__u8 *)r)[p->offset] ^ p->value) & p->mask)
+				return 0;
+			break;
+		case RP_ROOT:
+			if (r->rtm_family != p->family ||
+			    p->bits > ((__u8 *)r)[p->offset])
+				return 0;
+			/* fall through */
+		case RP_ADDR:
+			if (r->rtm_family != p->family)
+				return 0;
+			if (p->words == 0)
+				break;
+			rp_load(w, tb[p->attr], p->bytes);
+			for (i = 0; i < p->words; i++)
+				if ((w[i] ^ p->addr[i]) & p->amask[i])
+					return 0;
+			break;
+		case RP_MATCH:
+			if (r->rtm_family != p->family)
+				return 0;
+			if (p->bits < 0)
+				break;
+			len = ((__u8 *)r)[p->offset];
+			if (p->bits < len)
+				return 0;
+			rp_load(w, tb[p->attr], (len + 7) / 8);
+			for (i = 0; len > 0; i++, len -= 32) {
+				__u32 mask = len >= 32 ? ~0U : htonl(~0U << (32 - len));
 
+				if (i >= 4 || ((w[i] ^ p->addr[i]) & mask))
+					return 0;
+			}
+			break;
+		case RP_U32:
+			if (((tb[p->attr] ? rta_getattr_u32(tb[p->attr]) : 0) ^
+			     p->value) & p->mask)
+				return 0;
+			break;
+		case RP_FLUSH_V6:
+			if (r->rtm_family == AF_INET6 &&
+			    r->rtm_dst_len == 0 &&
+			    r->rtm_type == RTN_UNREACHABLE &&
+			    tb[RTA_PRIORITY] &&
+			    *(int*)RTA_DATA(tb[RTA_PRIORITY]) == -1)
+				return 0;
+			break;
+		}
+	}
 	return 1;
 }
 
@@ -277,24 +368,54 @@ int calc_host_len(struct rtmsg *r)
 		return -1;
 }
 
+/* print_route() also runs in the -jobs worker threads, so every thread
+ * parses into a table of its own.
+ */
+#ifdef ANDROID
+static struct rtattr_table route_table;
+#else
+static __thread struct rtattr_table route_table;
+#endif
+
+/* Set before the -jobs workers start; they only read it */
+static int hz;
+
+static struct rtattr **route_table_get(void)
+{
+	struct rtattr_table *t = &route_table;
+
+	if (t->tb == NULL) {
+		if (rtattr_table_init(t, RTA_MAX) < 0)
+			return NULL;
+		rtattr_table_minlen(t, RTA_OIF, sizeof(__u32));
+		rtattr_table_minlen(t, RTA_IIF, sizeof(__u32));
+		rtattr_table_minlen(t, RTA_PRIORITY, sizeof(__u32));
+		rtattr_table_minlen(t, RTA_FLOW, sizeof(__u32));
+		rtattr_table_minlen(t, RTA_TABLE, sizeof(__u32));
+		rtattr_table_minlen(t, RTA_MARK, sizeof(__u32));
+		rtattr_table_minlen(t, RTA_CACHEINFO,
+				    sizeof(struct rta_cacheinfo));
+	}
+	return t->tb;
+}
+
 int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE*)arg;
 	struct rtmsg *r = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct rtattr * tb[RTA_MAX+1];
+	struct rtattr **tb;
 	char abuf[256];
 	int host_len = -1;
 	__u32 table;
 	SPRINT_BUF(b1);
-	static int hz;
 
 	if (n->nlmsg_type != RTM_NEWROUTE && n->nlmsg_type != RTM_DELROUTE) {
 		fprintf(stderr, "Not a route: %08x %08x %08x\n",
 			n->nlmsg_len, n->nlmsg_type, n->nlmsg_flags);
 		return 0;
 	}
-	if (filter.flushb && n->nlmsg_type != RTM_NEWROUTE)
+	if (filter.flush && n->nlmsg_type != RTM_NEWROUTE)
 		return 0;
 	len -= NLMSG_LENGTH(sizeof(*r));
 	if (len < 0) {
@@ -304,24 +425,20 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 
 	host_len = calc_host_len(r);
 
-	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	tb = route_table_get();
+	if (tb == NULL) {
+		perror("Cannot allocate attribute table");
+		return -1;
+	}
+	rtattr_table_parse(&route_table, RTM_RTA(r), len);
 	table = rtm_get_table(r, tb);
 
 	if (!filter_nlmsg(n, tb, host_len))
 		return 0;
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
-				return -1;
-		}
-		fn = (struct nlmsghdr*)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELROUTE;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char*)fn) + n->nlmsg_len) - filter.flushb;
+	if (filter.flush) {
+		if (flush_add(n, RTM_DELROUTE) < 0)
+			return -1;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -383,7 +500,7 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 				    abuf, sizeof(abuf)));
 	}
 	if (tb[RTA_OIF] && filter.oifmask != -1)
-		fprintf(fp, "dev %s ", ll_index_to_name(*(int*)RTA_DATA(tb[RTA_OIF])));
+		fprintf(fp, "dev %s ", ll_idx_n2a(*(int*)RTA_DATA(tb[RTA_OIF]), b1));
 
 	if (!(r->rtm_flags&RTM_F_CLONED)) {
 		if (table != RT_TABLE_MAIN && !filter.tb)
@@ -559,10 +676,11 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 		}
 	}
 	if (tb[RTA_IIF] && filter.iifmask != -1) {
-		fprintf(fp, " iif %s", ll_index_to_name(*(int*)RTA_DATA(tb[RTA_IIF])));
+		fprintf(fp, " iif %s", ll_idx_n2a(*(int*)RTA_DATA(tb[RTA_IIF]), b1));
 	}
 	if (tb[RTA_MULTIPATH]) {
 		struct rtnexthop *nh = RTA_DATA(tb[RTA_MULTIPATH]);
+		struct rtattr *ntb[RTA_MAX+1];
 		int first = 0;
 
 		len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
@@ -580,16 +698,16 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 			} else
 				fprintf(fp, "%s\tnexthop", _SL_);
 			if (nh->rtnh_len > sizeof(*nh)) {
-				parse_rtattr(tb, RTA_MAX, RTNH_DATA(nh), nh->rtnh_len - sizeof(*nh));
-				if (tb[RTA_GATEWAY]) {
+				parse_rtattr(ntb, RTA_MAX, RTNH_DATA(nh), nh->rtnh_len - sizeof(*nh));
+				if (ntb[RTA_GATEWAY]) {
 					fprintf(fp, " via %s ",
 						format_host(r->rtm_family,
-							    RTA_PAYLOAD(tb[RTA_GATEWAY]),
-							    RTA_DATA(tb[RTA_GATEWAY]),
+							    RTA_PAYLOAD(ntb[RTA_GATEWAY]),
+							    RTA_DATA(ntb[RTA_GATEWAY]),
 							    abuf, sizeof(abuf)));
 				}
-				if (tb[RTA_FLOW]) {
-					__u32 to = rta_getattr_u32(tb[RTA_FLOW]);
+				if (ntb[RTA_FLOW]) {
+					__u32 to = rta_getattr_u32(ntb[RTA_FLOW]);
 					__u32 from = to>>16;
 					to &= 0xFFFF;
 					fprintf(fp, " realm%s ", from ? "s" : "");
@@ -602,11 +720,11 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 				}
 			}
 			if (r->rtm_flags&RTM_F_CLONED && r->rtm_type == RTN_MULTICAST) {
-				fprintf(fp, " %s", ll_index_to_name(nh->rtnh_ifindex));
+				fprintf(fp, " %s", ll_idx_n2a(nh->rtnh_ifindex, b1));
 				if (nh->rtnh_hops != 1)
 					fprintf(fp, "(ttl>%d)", nh->rtnh_hops);
 			} else {
-				fprintf(fp, " dev %s", ll_index_to_name(nh->rtnh_ifindex));
+				fprintf(fp, " dev %s", ll_idx_n2a(nh->rtnh_ifindex, b1));
 				fprintf(fp, " weight %d", nh->rtnh_hops+1);
 			}
 			if (nh->rtnh_flags & RTNH_F_DEAD)
@@ -961,18 +1079,14 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 		argc--; argv++;
 	}
 
-	if (d || nhs_ok)  {
+	if (d) {
 		int idx;
 
-		ll_init_map(&rth);
-
-		if (d) {
-			if ((idx = ll_name_to_index(d)) == 0) {
-				fprintf(stderr, "Cannot find device \"%s\"\n", d);
-				return -1;
-			}
-			addattr32(&req.n, sizeof(req), RTA_OIF, idx);
+		if ((idx = ll_name_to_index(d)) == 0) {
+			fprintf(stderr, "Cannot find device \"%s\"\n", d);
+			return -1;
 		}
+		addattr32(&req.n, sizeof(req), RTA_OIF, idx);
 	}
 
 	if (mxrta->rta_len > RTA_LENGTH(0)) {
@@ -1093,6 +1207,38 @@ int save_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	return ret == n->nlmsg_len ? 0 : ret;
 }
 
+/* Let the kernel leave out the routes that the filter would drop
+ * anyway: the table, the output device, the protocol and the type
+ * can go into the dump request.  An AF_UNSPEC dump is handed to every
+ * family, and some (MPLS) refuse a type or table under strict
+ * checking, so those two stay with filter_nlmsg() there.  It checks
+ * them either way, for kernels that cannot filter at all.
+ */
+static int iproute_dump_request(struct rtnl_handle *rth, int family)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct rtmsg	r;
+		char		buf[64];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req.n.nlmsg_type = RTM_GETROUTE;
+	req.r.rtm_family = family;
+
+	if (filter.tb > 0 && family != AF_UNSPEC)
+		addattr32(&req.n, sizeof(req), RTA_TABLE, filter.tb);
+	if (filter.oifmask == -1)
+		addattr32(&req.n, sizeof(req), RTA_OIF, filter.oif);
+	if (filter.protocolmask == -1)
+		req.r.rtm_protocol = filter.protocol;
+	if (filter.typemask == -1 && family != AF_UNSPEC)
+		req.r.rtm_type = filter.type;
+
+	return rtnl_dump_request_n(rth, &req.n);
+}
+
 static int iproute_list_flush_or_save(int argc, char **argv, int action)
 {
 	int do_ipv6 = preferred_family;
@@ -1263,12 +1409,9 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 		}
 	}
 	filter.mark = mark;
+	filter_compile();
 
 	if (action == IPROUTE_FLUSH) {
-		int round = 0;
-		char flushb[4096-512];
-		time_t start = time(0);
-
 		if (filter.cloned) {
 			if (do_ipv6 != AF_INET6) {
 				iproute_flush_cache();
@@ -1279,49 +1422,52 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 				return 0;
 		}
 
-		filter.flushb = flushb;
-		filter.flushp = 0;
-		filter.flushe = sizeof(flushb);
+		filter.flush = 1;
+		filter_compile();
 
-		for (;;) {
-			if (rtnl_wilddump_request(&rth, do_ipv6, RTM_GETROUTE) < 0) {
-				perror("Cannot send dump request");
-				exit(1);
-			}
-			filter.flushed = 0;
-			if (rtnl_dump_filter(&rth, filter_fn, stdout) < 0) {
-				fprintf(stderr, "Flush terminated\n");
-				exit(1);
-			}
-			if (filter.flushed == 0) {
-				if (show_stats) {
-					if (round == 0 && (!filter.cloned || do_ipv6 == AF_INET6))
-						printf("Nothing to flush.\n");
-					else
-						printf("*** Flush is complete after %d round%s ***\n", round, round>1?"s":"");
-				}
-				fflush(stdout);
-				return 0;
-			}
-			round++;
-			if (flush_update() < 0)
-				exit(1);
-
-			if (time(0) - start > 30) {
-				printf("\n*** Flush not completed after %ld seconds, %d entries remain ***\n",
-				       time(0) - start, filter.flushed);
-				exit(1);
-			}
-
-			if (show_stats) {
-				printf("\n*** Round %d, deleting %d entries ***\n", round, filter.flushed);
-				fflush(stdout);
-			}
+		if (iproute_dump_request(&rth, do_ipv6) < 0) {
+			perror("Cannot send dump request");
+			exit(1);
+		}
+		filter.flushed = 0;
+		if (rtnl_dump_filter(&rth, filter_fn, stdout) < 0) {
+			fprintf(stderr, "Flush terminated\n");
+			exit(1);
 		}
+		if (filter.flushed == 0) {
+			if (show_stats && (!filter.cloned || do_ipv6 == AF_INET6))
+				printf("Nothing to flush.\n");
+			fflush(stdout);
+			return 0;
+		}
+		if (flush_run(&rth, "entries"))
+			exit(1);
+		return 0;
 	}
 
+#ifndef ANDROID
+	/* print_route() only reads shared state once the name databases
+	 * are loaded; resolving names goes through the non reentrant
+	 * resolver, so that stays serial.
+	 */
+	if (dump_jobs > 1 && action == IPROUTE_LIST && !filter.cloned &&
+	    !resolve_hosts &&
+	    (do_ipv6 == AF_UNSPEC || do_ipv6 == AF_INET || do_ipv6 == AF_INET6)) {
+		static const int families[] = { AF_INET, AF_INET6 };
+
+		rtnl_names_initialize();
+		hz = get_user_hz();
+		if (rtnl_dump_parallel(do_ipv6 == AF_INET6 ? &families[1] : families,
+				       do_ipv6 == AF_UNSPEC ? 2 : 1,
+				       iproute_dump_request,
+				       filter_fn, dump_jobs, stdout) < 0)
+			exit(1);
+		exit(0);
+	}
+#endif
+
 	if (!filter.cloned) {
-		if (rtnl_wilddump_request(&rth, do_ipv6, RTM_GETROUTE) < 0) {
+		if (iproute_dump_request(&rth, do_ipv6) < 0) {
 			perror("Cannot send dump request");
 			exit(1);
 		}
@@ -1337,6 +1483,10 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 		exit(1);
 	}
 
+	if (show_stats > 1)
+		fprintf(stderr, "Dumped %u messages in %u receive calls\n",
+			rth.dump_msgs, rth.dump_recvs);
+
 	exit(0);
 }
 
@@ -1531,6 +1681,7 @@ void iproute_reset_filter()
 	memset(&filter, 0, sizeof(filter));
 	filter.mdst.bitlen = -1;
 	filter.msrc.bitlen = -1;
+	route_npreds = -1;
 }
 
 int do_iproute(int argc, char **argv)
@@ -155,6 +155,7 @@ main(int argc, char **argv)
 
 	if (rtnl_open(&rth, groups) < 0)
 		exit(1);
+	rtnl_rx_ring(&rth);	/* falls back to copying if unsupported */
 
 	if (rtnl_wilddump_request(&rth, AF_UNSPEC, RTM_GETLINK) < 0) {
 		perror("Cannot send dump request");
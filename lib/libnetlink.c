@@ -21,18 +21,270 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/time.h>
+#include <poll.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 
 #include "libnetlink.h"
 
+#ifndef SOL_NETLINK
+#define SOL_NETLINK	270
+#endif
+
 int rcvbuf = 1024 * 1024;
 
+#define RTNL_BATCH_RECV	64
+
+struct rtnl_batch_req
+{
+	__u32			seq;
+	int			tag;
+};
+
+struct rtnl_batch
+{
+	int			window;
+	int			pending;
+	__u32			first;
+	int			tag;
+	rtnl_batch_report_t	report;
+	void			*arg;
+	struct rtnl_batch_stats	stats;
+	struct timeval		start;
+	int			slen;
+	int			last;
+	char			sbuf[16384];
+	char			rbuf[RTNL_BATCH_RECV][256];
+	struct rtnl_batch_req	req[0];
+};
+
+/* Receive ring for dumps and monitoring.  A dump skb is never larger
+ * than 32K, and every recvmsg lets the kernel fill the next one, so a
+ * single recvmmsg drains up to RTNL_RING_SLOTS skbs of a dump (or that
+ * many queued notifications) per syscall.
+ *
+ * When rtnl_rx_ring() succeeded, the slots instead point straight into
+ * frames of the kernel's NETLINK_RX_RING; those frames stay owned by us
+ * until the next receive (or the end of the dump/listen loop).
+ *
+ * A receive may also pick up what follows the end of a dump, e.g. the
+ * notifications of a subscribed handle.  Slots the caller did not get
+ * to ("next" up to "count") stay on the handle, together with their
+ * frames, and the next dump or listen loop is handed them first.
+ */
+#define RTNL_RING_SLOTS		16
+#define RTNL_RING_SLOT_SIZE	32768
+
+#define RTNL_RX_RING_SIZE	(4 * 1024 * 1024)
+#define RTNL_RX_FRAME_SIZE	16384
+
+struct rtnl_ring
+{
+	struct mmsghdr		msgs[RTNL_RING_SLOTS];
+	struct iovec		iov[RTNL_RING_SLOTS];
+	struct sockaddr_nl	addr[RTNL_RING_SLOTS];
+	char			*data[RTNL_RING_SLOTS];
+	int			count;
+	int			next;
+
+	void			*rx_ring;
+	size_t			rx_size;
+	unsigned int		rx_frame_size;
+	unsigned int		rx_frame_nr;
+	unsigned int		rx_head;
+	unsigned int		rx_held;
+	unsigned int		frame[RTNL_RING_SLOTS];
+
+	char			buf[RTNL_RING_SLOTS][RTNL_RING_SLOT_SIZE];
+};
+
 void rtnl_close(struct rtnl_handle *rth)
 {
+	if (rth->ring && rth->ring->rx_ring)
+		munmap(rth->ring->rx_ring, rth->ring->rx_size);
 	if (rth->fd >= 0) {
 		close(rth->fd);
 		rth->fd = -1;
 	}
+	free(rth->batch);
+	rth->batch = NULL;
+	free(rth->ring);
+	rth->ring = NULL;
+}
+
+static struct rtnl_ring *rtnl_ring_get(struct rtnl_handle *rth)
+{
+	if (rth->ring == NULL)
+		rth->ring = calloc(1, sizeof(*rth->ring));
+	return rth->ring;
+}
+
+int rtnl_rx_ring(struct rtnl_handle *rth)
+{
+	struct rtnl_ring *r = rtnl_ring_get(rth);
+	struct nl_mmap_req req;
+	long pgsz = sysconf(_SC_PAGESIZE);
+	void *ring;
+
+	if (r == NULL)
+		return -1;
+	if (r->rx_ring)
+		return 0;
+
+	req.nm_block_size = pgsz > RTNL_RX_FRAME_SIZE ? pgsz : RTNL_RX_FRAME_SIZE;
+	req.nm_block_nr = RTNL_RX_RING_SIZE / req.nm_block_size;
+	req.nm_frame_size = RTNL_RX_FRAME_SIZE;
+	req.nm_frame_nr = req.nm_block_nr * (req.nm_block_size / req.nm_frame_size);
+
+	/* Kernels without mmap'ed netlink say ENOPROTOOPT; stay on copies */
+	if (setsockopt(rth->fd, SOL_NETLINK, NETLINK_RX_RING, &req, sizeof(req)) < 0)
+		return -1;
+
+	ring = mmap(NULL, req.nm_block_size * req.nm_block_nr,
+		    PROT_READ|PROT_WRITE, MAP_SHARED, rth->fd, 0);
+	if (ring == MAP_FAILED) {
+		memset(&req, 0, sizeof(req));
+		setsockopt(rth->fd, SOL_NETLINK, NETLINK_RX_RING, &req, sizeof(req));
+		return -1;
+	}
+
+	r->rx_ring = ring;
+	r->rx_size = req.nm_block_size * req.nm_block_nr;
+	r->rx_frame_size = req.nm_frame_size;
+	r->rx_frame_nr = req.nm_frame_nr;
+	r->rx_head = 0;
+	r->rx_held = 0;
+	return 0;
+}
+
+static struct nl_mmap_hdr *rtnl_rx_frame(struct rtnl_ring *r, unsigned int i)
+{
+	return r->rx_ring + (i % r->rx_frame_nr) * r->rx_frame_size;
+}
+
+/* Give the frames handed out by the last receive back to the kernel,
+ * up to the first slot that was not processed yet.
+ */
+static void rtnl_ring_release(struct rtnl_handle *rth)
+{
+	struct rtnl_ring *r = rth->ring;
+	unsigned int keep = 0;
+
+	if (r == NULL || r->rx_ring == NULL)
+		return;
+
+	if (r->next < r->count)
+		keep = (r->rx_head + r->rx_frame_nr - r->frame[r->next]) %
+			r->rx_frame_nr;
+
+	__sync_synchronize();
+	while (r->rx_held > keep) {
+		struct nl_mmap_hdr *hdr;
+
+		hdr = rtnl_rx_frame(r, r->rx_head + r->rx_frame_nr - r->rx_held);
+		hdr->nm_status = NL_MMAP_STATUS_UNUSED;
+		r->rx_held--;
+	}
+}
+
+static int rtnl_rx_ring_recv(struct rtnl_handle *rth)
+{
+	struct rtnl_ring *r = rth->ring;
+	struct pollfd pfd = { .fd = rth->fd, .events = POLLIN };
+
+	rtnl_ring_release(rth);
+
+	while (1) {
+		int n = 0;
+
+		while (n < RTNL_RING_SLOTS) {
+			struct nl_mmap_hdr *hdr = rtnl_rx_frame(r, r->rx_head);
+			unsigned int status = hdr->nm_status;
+
+			__sync_synchronize();
+			if (status == NL_MMAP_STATUS_VALID) {
+				r->frame[n] = r->rx_head;
+				r->data[n] = (char *)hdr + NL_MMAP_HDRLEN;
+				r->msgs[n].msg_len = hdr->nm_len;
+				n++;
+			} else if (status == NL_MMAP_STATUS_COPY) {
+				/* Did not fit into a frame, it waits in the queue */
+				int len = recvmsg(rth->fd, &r->msgs[n].msg_hdr, 0);
+
+				if (len < 0) {
+					if (n)
+						break;
+					return -1;
+				}
+				r->frame[n] = r->rx_head;
+				r->data[n] = r->buf[n];
+				r->msgs[n].msg_len = len;
+				n++;
+			} else if (status != NL_MMAP_STATUS_SKIP) {
+				break;
+			}
+			r->rx_head = (r->rx_head + 1) % r->rx_frame_nr;
+			r->rx_held++;
+		}
+
+		if (n)
+			return n;
+		if (r->rx_held) {
+			rtnl_ring_release(rth);
+			continue;
+		}
+
+		/* Polling also lets the kernel run the next step of a dump */
+		if (poll(&pfd, 1, -1) < 0)
+			return -1;
+		if (pfd.revents & POLLERR) {
+			char c;
+
+			/* Picks up the pending socket error, e.g. ENOBUFS */
+			if (recv(rth->fd, &c, sizeof(c), MSG_DONTWAIT) < 0)
+				return -1;
+		}
+	}
+}
+
+/* Returns the number of filled slots, or -1 with errno set.  The caller
+ * processes them from r->next on, advancing r->next past each slot
+ * before it looks at it; what is left is returned again next time.
+ */
+static int rtnl_ring_recv(struct rtnl_handle *rth)
+{
+	struct rtnl_ring *r = rtnl_ring_get(rth);
+	int i, n;
+
+	if (r == NULL)
+		return -1;
+	if (r->next < r->count)
+		return r->count;
+	r->next = r->count = 0;
+
+	for (i = 0; i < RTNL_RING_SLOTS; i++) {
+		r->data[i] = r->buf[i];
+		r->iov[i].iov_base = r->buf[i];
+		r->iov[i].iov_len = RTNL_RING_SLOT_SIZE;
+		memset(&r->msgs[i], 0, sizeof(r->msgs[i]));
+		memset(&r->addr[i], 0, sizeof(r->addr[i]));
+		r->addr[i].nl_family = AF_NETLINK;
+		r->msgs[i].msg_hdr.msg_name = &r->addr[i];
+		r->msgs[i].msg_hdr.msg_namelen = sizeof(r->addr[i]);
+		r->msgs[i].msg_hdr.msg_iov = &r->iov[i];
+		r->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	if (r->rx_ring)
+		n = rtnl_rx_ring_recv(rth);
+	else
+		n = recvmmsg(rth->fd, r->msgs, RTNL_RING_SLOTS, MSG_WAITFORONE, NULL);
+	if (n > 0)
+		r->count = n;
+	if (n >= 0)
+		rth->dump_recvs++;
+	return n;
 }
 
 int rtnl_open_byproto(struct rtnl_handle *rth, unsigned subscriptions,
@@ -54,7 +306,9 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned subscriptions,
 		return -1;
 	}
 
-	if (setsockopt(rth->fd,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf)) < 0) {
+	/* Go past rmem_max when allowed to, so that -rcvbuf is honoured */
+	if (setsockopt(rth->fd,SOL_SOCKET,SO_RCVBUFFORCE,&rcvbuf,sizeof(rcvbuf)) < 0 &&
+	    setsockopt(rth->fd,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf)) < 0) {
 		perror("SO_RCVBUF");
 		return -1;
 	}
@@ -89,6 +343,230 @@ int rtnl_open(struct rtnl_handle *rth, unsigned subscriptions)
 	return rtnl_open_byproto(rth, subscriptions, NETLINK_ROUTE);
 }
 
+int rtnl_batch_start(struct rtnl_handle *rth, int window,
+		     rtnl_batch_report_t report, void *arg)
+{
+	struct rtnl_batch *b;
+
+	if (window < 1)
+		window = 1;
+
+	b = calloc(1, sizeof(*b) + window * sizeof(struct rtnl_batch_req));
+	if (b == NULL) {
+		perror("rtnl_batch_start");
+		return -1;
+	}
+	b->window = window;
+	b->report = report;
+	b->arg = arg;
+	gettimeofday(&b->start, NULL);
+
+	free(rth->batch);
+	rth->batch = b;
+	return 0;
+}
+
+void rtnl_batch_tag(struct rtnl_handle *rth, int tag)
+{
+	if (rth->batch)
+		rth->batch->tag = tag;
+}
+
+static int rtnl_batch_send(struct rtnl_handle *rth)
+{
+	struct rtnl_batch *b = rth->batch;
+	int status;
+
+	if (b->slen == 0)
+		return 0;
+
+	/* Only the last request of a send asks for an ACK.  Failures are
+	 * reported regardless, and the kernel handles the requests in
+	 * order, so that one ACK accounts for all of them.
+	 */
+	((struct nlmsghdr *)(b->sbuf + b->last))->nlmsg_flags |= NLM_F_ACK;
+
+	status = send(rth->fd, b->sbuf, b->slen, 0);
+	b->slen = 0;
+	if (status < 0) {
+		perror("Cannot talk to rtnetlink");
+		return -1;
+	}
+	b->stats.sendmsgs++;
+	b->stats.bytes += status;
+	return 0;
+}
+
+static void rtnl_batch_ack(struct rtnl_handle *rth, struct nlmsghdr *h)
+{
+	struct rtnl_batch *b = rth->batch;
+	struct rtnl_batch_req *r;
+	struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
+
+	if (h->nlmsg_pid != rth->local.nl_pid || h->nlmsg_type != NLMSG_ERROR)
+		return;
+
+	if (h->nlmsg_seq - b->first >= (__u32)b->pending)
+		return;
+	r = &b->req[h->nlmsg_seq % b->window];
+	if (r->seq != h->nlmsg_seq)
+		return;
+
+	/* Everything queued before this request has been handled too */
+	b->pending -= h->nlmsg_seq - b->first + 1;
+	b->first = h->nlmsg_seq + 1;
+
+	if (err->error) {
+		b->stats.failed++;
+		if (b->report)
+			b->report(r->tag, -err->error, b->arg);
+		else {
+			errno = -err->error;
+			perror("RTNETLINK answers");
+		}
+	}
+}
+
+/* Pick up as many ACKs as are queued, waiting for at least one.
+ * Only the headers matter, so the slots are small and an error
+ * reply echoing a large request is simply truncated.
+ */
+static int rtnl_batch_recv(struct rtnl_handle *rth)
+{
+	struct rtnl_batch *b = rth->batch;
+	struct sockaddr_nl nladdr[RTNL_BATCH_RECV];
+	struct iovec iov[RTNL_BATCH_RECV];
+	struct mmsghdr msgs[RTNL_BATCH_RECV];
+	int i, n;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < RTNL_BATCH_RECV; i++) {
+		iov[i].iov_base = b->rbuf[i];
+		iov[i].iov_len = sizeof(b->rbuf[i]);
+		msgs[i].msg_hdr.msg_name = &nladdr[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(nladdr[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		n = recvmmsg(rth->fd, msgs, RTNL_BATCH_RECV, MSG_WAITFORONE,
+			     NULL);
+	} while (n < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (n < 0) {
+		/* ENOBUFS means ACKs were dropped: the window is lost. */
+		fprintf(stderr, "netlink receive error %s (%d)\n",
+			strerror(errno), errno);
+		return -1;
+	}
+	if (n == 0) {
+		fprintf(stderr, "EOF on netlink\n");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct nlmsghdr *h = (struct nlmsghdr*)b->rbuf[i];
+		int len = msgs[i].msg_len;
+
+		if (nladdr[i].nl_pid != 0)
+			continue;
+
+		while (len >= (int)NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+			rtnl_batch_ack(rth, h);
+			if (h->nlmsg_len < sizeof(*h) ||
+			    NLMSG_ALIGN(h->nlmsg_len) >= len)
+				break;
+			len -= NLMSG_ALIGN(h->nlmsg_len);
+			h = (struct nlmsghdr*)((char*)h + NLMSG_ALIGN(h->nlmsg_len));
+		}
+	}
+	return 0;
+}
+
+/* Returns 1 if the request is too large to be queued. */
+static int rtnl_batch_queue(struct rtnl_handle *rth, struct nlmsghdr *n)
+{
+	struct rtnl_batch *b = rth->batch;
+	struct rtnl_batch_req *r;
+	int len = NLMSG_ALIGN(n->nlmsg_len);
+
+	if (len > sizeof(b->sbuf))
+		return 1;
+
+	if (b->slen + len > sizeof(b->sbuf) && rtnl_batch_send(rth) < 0)
+		return -1;
+
+	/* Window full: push out what is queued and collect ACKs until
+	 * it is half empty, so that sends keep going out in bulk.
+	 */
+	if (b->pending >= b->window) {
+		if (rtnl_batch_send(rth) < 0)
+			return -1;
+		while (b->pending > b->window / 2) {
+			if (rtnl_batch_recv(rth) < 0)
+				return -1;
+		}
+	}
+
+	n->nlmsg_seq = ++rth->seq;
+	memcpy(b->sbuf + b->slen, n, n->nlmsg_len);
+	memset(b->sbuf + b->slen + n->nlmsg_len, 0, len - n->nlmsg_len);
+	b->last = b->slen;
+	b->slen += len;
+
+	r = &b->req[n->nlmsg_seq % b->window];
+	r->seq = n->nlmsg_seq;
+	r->tag = b->tag;
+	if (b->pending++ == 0)
+		b->first = n->nlmsg_seq;
+	b->stats.requests++;
+	return 0;
+}
+
+int rtnl_batch_flush(struct rtnl_handle *rth)
+{
+	struct rtnl_batch *b = rth->batch;
+
+	if (b == NULL)
+		return 0;
+
+	if (rtnl_batch_send(rth) < 0)
+		return -1;
+
+	while (b->pending > 0) {
+		if (rtnl_batch_recv(rth) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+void rtnl_batch_stop(struct rtnl_handle *rth, struct rtnl_batch_stats *stats)
+{
+	struct rtnl_batch *b = rth->batch;
+	struct timeval now;
+
+	if (b == NULL)
+		return;
+	if (stats) {
+		gettimeofday(&now, NULL);
+		b->stats.seconds = (now.tv_sec - b->start.tv_sec) +
+			(now.tv_usec - b->start.tv_usec) / 1000000.;
+		*stats = b->stats;
+	}
+	free(rth->batch);
+	rth->batch = NULL;
+}
+
+void rtnl_batch_print_stats(FILE *fp, const struct rtnl_batch_stats *s)
+{
+	fprintf(fp, "Batch: %lu requests, %lu failed, %lu sendmsg calls, "
+		"%lu bytes", s->requests, s->failed, s->sendmsgs, s->bytes);
+	if (s->seconds > 0)
+		fprintf(fp, ", %.0f requests/s", s->requests / s->seconds);
+	fprintf(fp, "\n");
+}
+
 int rtnl_wilddump_request(struct rtnl_handle *rth, int family, int type)
 {
 	struct {
@@ -99,6 +577,9 @@ int rtnl_wilddump_request(struct rtnl_handle *rth, int family, int type)
 		__u32 ext_filter_mask;
 	} req;
 
+	if (rtnl_batch_flush(rth) < 0)
+		return -1;
+
 	memset(&req, 0, sizeof(req));
 	req.nlh.nlmsg_len = sizeof(req);
 	req.nlh.nlmsg_type = type;
@@ -106,6 +587,7 @@ int rtnl_wilddump_request(struct rtnl_handle *rth, int family, int type)
 	req.nlh.nlmsg_pid = 0;
 	req.nlh.nlmsg_seq = rth->dump = ++rth->seq;
 	req.g.rtgen_family = family;
+	rth->flags &= ~RTNL_HANDLE_F_FILTERED;
 
 	req.ext_req.rta_type = IFLA_EXT_MASK;
 	req.ext_req.rta_len = RTA_LENGTH(sizeof(__u32));
@@ -116,6 +598,8 @@ int rtnl_wilddump_request(struct rtnl_handle *rth, int family, int type)
 
 int rtnl_send(struct rtnl_handle *rth, const void *buf, int len)
 {
+	if (rtnl_batch_flush(rth) < 0)
+		return -1;
 	return send(rth->fd, buf, len, 0);
 }
 
@@ -125,6 +609,9 @@ int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int len)
 	int status;
 	char resp[1024];
 
+	if (rtnl_batch_flush(rth) < 0)
+		return -1;
+
 	status = send(rth->fd, buf, len, 0);
 	if (status < 0)
 		return status;
@@ -167,39 +654,63 @@ int rtnl_dump_request(struct rtnl_handle *rth, int type, void *req, int len)
 		.msg_iovlen = 2,
 	};
 
+	if (rtnl_batch_flush(rth) < 0)
+		return -1;
+
 	nlh.nlmsg_len = NLMSG_LENGTH(len);
 	nlh.nlmsg_type = type;
 	nlh.nlmsg_flags = NLM_F_DUMP|NLM_F_REQUEST;
 	nlh.nlmsg_pid = 0;
 	nlh.nlmsg_seq = rth->dump = ++rth->seq;
+	rth->flags &= ~RTNL_HANDLE_F_FILTERED;
 
 	return sendmsg(rth->fd, &msg, 0);
 }
 
-int rtnl_dump_filter_l(struct rtnl_handle *rth,
-		       const struct rtnl_dump_filter_arg *arg)
+/* Dump request with a full family header and filter attributes.  The
+ * kernel only honours them with strict checking, which is enabled for
+ * this request alone, as it would reject the short headers of the
+ * other dump requests.  Older kernels ignore the filter, so callers
+ * still have to apply it themselves.
+ */
+int rtnl_dump_request_n(struct rtnl_handle *rth, struct nlmsghdr *n)
 {
-	struct sockaddr_nl nladdr;
-	struct iovec iov;
-	struct msghdr msg = {
-		.msg_name = &nladdr,
-		.msg_namelen = sizeof(nladdr),
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
-	};
-	char buf[16384];
+	int on = 1, off = 0;
+	int strict, ret;
 
-	iov.iov_base = buf;
-	while (1) {
-		int status;
-		const struct rtnl_dump_filter_arg *a;
-		int found_done = 0;
-		int msglen = 0;
+	if (rtnl_batch_flush(rth) < 0)
+		return -1;
 
-		iov.iov_len = sizeof(buf);
-		status = recvmsg(rth->fd, &msg, 0);
+	n->nlmsg_flags = NLM_F_DUMP|NLM_F_REQUEST;
+	n->nlmsg_pid = 0;
+	n->nlmsg_seq = rth->dump = ++rth->seq;
 
-		if (status < 0) {
+	strict = setsockopt(rth->fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
+			    &on, sizeof(on)) == 0;
+	if (strict)
+		rth->flags |= RTNL_HANDLE_F_FILTERED;
+	else
+		rth->flags &= ~RTNL_HANDLE_F_FILTERED;
+
+	ret = send(rth->fd, n, n->nlmsg_len, 0);
+
+	if (strict)
+		setsockopt(rth->fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
+			   &off, sizeof(off));
+	return ret;
+}
+
+static int __rtnl_dump_filter_l(struct rtnl_handle *rth,
+				const struct rtnl_dump_filter_arg *arg)
+{
+	rth->dump_recvs = 0;
+	rth->dump_msgs = 0;
+
+	while (1) {
+		int n, i;
+
+		n = rtnl_ring_recv(rth);
+		if (n < 0) {
 			if (errno == EINTR || errno == EAGAIN)
 				continue;
 			fprintf(stderr, "netlink receive error %s (%d)\n",
@@ -207,61 +718,98 @@ int rtnl_dump_filter_l(struct rtnl_handle *rth,
 			return -1;
 		}
 
-		if (status == 0) {
+		if (n == 0) {
 			fprintf(stderr, "EOF on netlink\n");
 			return -1;
 		}
 
-		for (a = arg; a->filter; a++) {
-			struct nlmsghdr *h = (struct nlmsghdr*)buf;
-			msglen = status;
+		for (i = rth->ring->next; i < n; i++) {
+			struct msghdr *msg = &rth->ring->msgs[i].msg_hdr;
+			struct sockaddr_nl *nladdr = &rth->ring->addr[i];
+			char *buf = rth->ring->data[i];
+			int status = rth->ring->msgs[i].msg_len;
+			const struct rtnl_dump_filter_arg *a;
+			int found_done = 0;
+			int msglen = 0;
+
+			rth->ring->next = i + 1;
+			if (status == 0) {
+				fprintf(stderr, "EOF on netlink\n");
+				return -1;
+			}
 
-			while (NLMSG_OK(h, msglen)) {
-				int err;
+			for (a = arg; a->filter; a++) {
+				struct nlmsghdr *h = (struct nlmsghdr*)buf;
+				msglen = status;
 
-				if (nladdr.nl_pid != 0 ||
-				    h->nlmsg_pid != rth->local.nl_pid ||
-				    h->nlmsg_seq != rth->dump)
-					goto skip_it;
+				while (NLMSG_OK(h, msglen)) {
+					int err;
 
-				if (h->nlmsg_type == NLMSG_DONE) {
-					found_done = 1;
-					break; /* process next filter */
-				}
-				if (h->nlmsg_type == NLMSG_ERROR) {
-					struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
-					if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
-						fprintf(stderr,
-							"ERROR truncated\n");
-					} else {
-						errno = -err->error;
-						perror("RTNETLINK answers");
+					if (nladdr->nl_pid != 0 ||
+					    h->nlmsg_pid != rth->local.nl_pid ||
+					    h->nlmsg_seq != rth->dump)
+						goto skip_it;
+
+					if (h->nlmsg_type == NLMSG_DONE) {
+						found_done = 1;
+						break; /* process next filter */
 					}
-					return -1;
-				}
-				err = a->filter(&nladdr, h, a->arg1);
-				if (err < 0)
-					return err;
+					if (h->nlmsg_type == NLMSG_ERROR) {
+						struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
+						if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+							fprintf(stderr,
+								"ERROR truncated\n");
+						} else {
+							errno = -err->error;
+							/* A filtered dump for a table or
+							 * device that is not there */
+							if ((rth->flags & RTNL_HANDLE_F_FILTERED) &&
+							    (errno == ENOENT || errno == ENODEV)) {
+								found_done = 1;
+								break;
+							}
+							if (!(rth->flags & RTNL_HANDLE_F_QUIET))
+								perror("RTNETLINK answers");
+						}
+						return -1;
+					}
+					if (a == arg)
+						rth->dump_msgs++;
+					err = a->filter(nladdr, h, a->arg1);
+					if (err < 0)
+						return err;
 
 skip_it:
-				h = NLMSG_NEXT(h, msglen);
+					h = NLMSG_NEXT(h, msglen);
+				}
 			}
-		}
 
-		if (found_done)
-			return 0;
+			if (found_done)
+				return 0;
 
-		if (msg.msg_flags & MSG_TRUNC) {
-			fprintf(stderr, "Message truncated\n");
-			continue;
-		}
-		if (msglen) {
-			fprintf(stderr, "!!!Remnant of size %d\n", msglen);
-			exit(1);
+			if (msg->msg_flags & MSG_TRUNC) {
+				fprintf(stderr, "Message truncated\n");
+				continue;
+			}
+			if (msglen) {
+				fprintf(stderr, "!!!Remnant of size %d\n", msglen);
+				exit(1);
+			}
 		}
 	}
 }
 
+int rtnl_dump_filter_l(struct rtnl_handle *rth,
+		       const struct rtnl_dump_filter_arg *arg)
+{
+	int ret = __rtnl_dump_filter_l(rth, arg);
+	int saved_errno = errno;
+
+	rtnl_ring_release(rth);
+	errno = saved_errno;
+	return ret;
+}
+
 int rtnl_dump_filter(struct rtnl_handle *rth,
 		     rtnl_filter_t filter,
 		     void *arg1)
@@ -291,7 +839,26 @@ int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 	};
-	char   buf[16384];
+	char   buf[32768];
+
+	/* Replies would land in frames that rtnl_talk does not walk */
+	if (rtnl->ring && rtnl->ring->rx_ring) {
+		fprintf(stderr, "rtnl_talk: not supported on a mmap'ed handle\n");
+		return -1;
+	}
+
+	if (rtnl->capture && answer == NULL && peer == 0 && groups == 0)
+		return rtnl->capture(&rtnl->peer, n, rtnl->capture_arg);
+
+	if (rtnl->batch) {
+		if (answer == NULL && peer == 0 && groups == 0) {
+			status = rtnl_batch_queue(rtnl, n);
+			if (status <= 0)
+				return status;
+		}
+		if (rtnl_batch_flush(rtnl) < 0)
+			return -1;
+	}
 
 	memset(&nladdr, 0, sizeof(nladdr));
 	nladdr.nl_family = AF_NETLINK;
@@ -391,33 +958,15 @@ int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
 	}
 }
 
-int rtnl_listen(struct rtnl_handle *rtnl,
-		rtnl_filter_t handler,
-		void *jarg)
+static int __rtnl_listen(struct rtnl_handle *rtnl,
+			 rtnl_filter_t handler,
+			 void *jarg)
 {
-	int status;
-	struct nlmsghdr *h;
-	struct sockaddr_nl nladdr;
-	struct iovec iov;
-	struct msghdr msg = {
-		.msg_name = &nladdr,
-		.msg_namelen = sizeof(nladdr),
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
-	};
-	char   buf[8192];
-
-	memset(&nladdr, 0, sizeof(nladdr));
-	nladdr.nl_family = AF_NETLINK;
-	nladdr.nl_pid = 0;
-	nladdr.nl_groups = 0;
-
-	iov.iov_base = buf;
 	while (1) {
-		iov.iov_len = sizeof(buf);
-		status = recvmsg(rtnl->fd, &msg, 0);
+		int n, i;
 
-		if (status < 0) {
+		n = rtnl_ring_recv(rtnl);
+		if (n < 0) {
 			if (errno == EINTR || errno == EAGAIN)
 				continue;
 			fprintf(stderr, "netlink receive error %s (%d)\n",
@@ -426,46 +975,73 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 				continue;
 			return -1;
 		}
-		if (status == 0) {
+		if (n == 0) {
 			fprintf(stderr, "EOF on netlink\n");
 			return -1;
 		}
-		if (msg.msg_namelen != sizeof(nladdr)) {
-			fprintf(stderr, "Sender address length == %d\n", msg.msg_namelen);
-			exit(1);
-		}
-		for (h = (struct nlmsghdr*)buf; status >= sizeof(*h); ) {
-			int err;
-			int len = h->nlmsg_len;
-			int l = len - sizeof(*h);
 
-			if (l<0 || len>status) {
-				if (msg.msg_flags & MSG_TRUNC) {
-					fprintf(stderr, "Truncated message\n");
-					return -1;
-				}
-				fprintf(stderr, "!!!malformed message: len=%d\n", len);
+		for (i = rtnl->ring->next; i < n; i++) {
+			struct msghdr *msg = &rtnl->ring->msgs[i].msg_hdr;
+			struct sockaddr_nl *nladdr = &rtnl->ring->addr[i];
+			int status = rtnl->ring->msgs[i].msg_len;
+			struct nlmsghdr *h;
+
+			rtnl->ring->next = i + 1;
+			if (status == 0) {
+				fprintf(stderr, "EOF on netlink\n");
+				return -1;
+			}
+			if (msg->msg_namelen != sizeof(*nladdr)) {
+				fprintf(stderr, "Sender address length == %d\n", msg->msg_namelen);
 				exit(1);
 			}
+			for (h = (struct nlmsghdr*)rtnl->ring->data[i]; status >= sizeof(*h); ) {
+				int err;
+				int len = h->nlmsg_len;
+				int l = len - sizeof(*h);
 
-			err = handler(&nladdr, h, jarg);
-			if (err < 0)
-				return err;
+				if (l<0 || len>status) {
+					if (msg->msg_flags & MSG_TRUNC) {
+						fprintf(stderr, "Truncated message\n");
+						return -1;
+					}
+					fprintf(stderr, "!!!malformed message: len=%d\n", len);
+					exit(1);
+				}
 
-			status -= NLMSG_ALIGN(len);
-			h = (struct nlmsghdr*)((char*)h + NLMSG_ALIGN(len));
-		}
-		if (msg.msg_flags & MSG_TRUNC) {
-			fprintf(stderr, "Message truncated\n");
-			continue;
-		}
-		if (status) {
-			fprintf(stderr, "!!!Remnant of size %d\n", status);
-			exit(1);
+				err = handler(nladdr, h, jarg);
+				if (err < 0)
+					return err;
+
+				status -= NLMSG_ALIGN(len);
+				h = (struct nlmsghdr*)((char*)h + NLMSG_ALIGN(len));
+			}
+			if (msg->msg_flags & MSG_TRUNC) {
+				fprintf(stderr, "Message truncated\n");
+				continue;
+			}
+			if (status) {
+				fprintf(stderr, "!!!Remnant of size %d\n", status);
+				exit(1);
+			}
 		}
 	}
 }
 
+int rtnl_listen(struct rtnl_handle *rtnl,
+		rtnl_filter_t handler,
+		void *jarg)
+{
+	int ret;
+
+	if (rtnl_batch_flush(rtnl) < 0)
+		return -1;
+
+	ret = __rtnl_listen(rtnl, handler, jarg);
+	rtnl_ring_release(rtnl);
+	return ret;
+}
+
 int rtnl_from_file(FILE *rtnl, rtnl_filter_t handler,
 		   void *jarg)
 {
@@ -662,6 +1238,125 @@ int parse_rtattr(struct rtattr *tb[], int max, struct rtattr *rta, int len)
 	return 0;
 }
 
+/* Sets the table up for types 0..max; growing a table that is in use
+ * keeps the policy of the types it already had.
+ */
+int rtattr_table_init(struct rtattr_table *t, int max)
+{
+	struct rtattr **tb;
+	__u16 *policy;
+
+	if (t->tb && max <= t->max)
+		return 0;
+
+	if (max < RTATTR_TABLE_INLINE) {
+		tb = t->tb_inline;
+		policy = t->policy_inline;
+	} else {
+		tb = calloc(max + 1, sizeof(*tb));
+		policy = calloc(max + 1, sizeof(*policy));
+		if (tb == NULL || policy == NULL) {
+			free(tb);
+			free(policy);
+			return -1;
+		}
+	}
+
+	if (t->tb) {
+		if (policy != t->policy)
+			memcpy(policy, t->policy,
+			       (t->max + 1) * sizeof(*policy));
+		else
+			memset(policy + t->max + 1, 0,
+			       (max - t->max) * sizeof(*policy));
+		if (t->tb != t->tb_inline) {
+			free(t->tb);
+			free(t->policy);
+		}
+	} else
+		memset(policy, 0, (max + 1) * sizeof(*policy));
+	memset(tb, 0, (max + 1) * sizeof(*tb));
+
+	t->tb = tb;
+	t->policy = policy;
+	t->max = max;
+	t->top = -1;
+	return 0;
+}
+
+void rtattr_table_free(struct rtattr_table *t)
+{
+	if (t->tb && t->tb != t->tb_inline) {
+		free(t->tb);
+		free(t->policy);
+	}
+	memset(t, 0, sizeof(*t));
+}
+
+/* Attributes of this type are not entered at all. */
+int rtattr_table_skip(struct rtattr_table *t, int type)
+{
+	if (type > t->max)
+		return -1;
+	t->policy[type] = RTATTR_SKIP;
+	t->policed = 1;
+	return 0;
+}
+
+/* Attributes of this type with less payload are dropped. */
+int rtattr_table_minlen(struct rtattr_table *t, int type, int len)
+{
+	if (type > t->max || len >= RTATTR_SKIP)
+		return -1;
+	t->policy[type] = len;
+	t->policed = 1;
+	return 0;
+}
+
+int rtattr_table_parse(struct rtattr_table *t, struct rtattr *rta, int len)
+{
+	struct rtattr **tb = t->tb;
+	const __u16 *policy = t->policy;
+	unsigned max = t->max;
+	int top = -1;
+
+	/* Only the span the previous message filled can be dirty */
+	if (t->top >= 0)
+		memset(tb, 0, (t->top + 1) * sizeof(*tb));
+
+	/* The policy costs a load and a branch per attribute, so tables
+	 * without one take a loop of their own.
+	 */
+	if (!t->policed) {
+		while (RTA_OK(rta, len)) {
+			unsigned type = rta->rta_type;
+
+			if (type <= max && !tb[type]) {
+				tb[type] = rta;
+				if ((int)type > top)
+					top = type;
+			}
+			rta = RTA_NEXT(rta,len);
+		}
+	} else {
+		while (RTA_OK(rta, len)) {
+			unsigned type = rta->rta_type;
+
+			if (type <= max && !tb[type] &&
+			    RTA_PAYLOAD(rta) >= policy[type]) {
+				tb[type] = rta;
+				if ((int)type > top)
+					top = type;
+			}
+			rta = RTA_NEXT(rta,len);
+		}
+	}
+	t->top = top;
+	if (len)
+		fprintf(stderr, "!!!Deficit %d, rta_len=%d\n", len, rta->rta_len);
+	return 0;
+}
+
 int parse_rtattr_byindex(struct rtattr *tb[], int max, struct rtattr *rta, int len)
 {
 	int i = 0;
@@ -15,9 +15,11 @@
 #include <unistd.h>
 #include <syslog.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <fnmatch.h>
 #include <linux/if.h>
 
 #include "libnetlink.h"
@@ -28,6 +30,8 @@ extern unsigned int if_nametoindex (const char *);
 struct ll_cache
 {
 	struct ll_cache   *idx_next;
+	struct ll_cache   *name_next;
+	unsigned	name_hash;
 	unsigned	flags;
 	int		index;
 	unsigned short	type;
@@ -36,12 +40,89 @@ struct ll_cache
 	unsigned char	addr[20];
 };
 
-#define IDXMAP_SIZE	1024
-static struct ll_cache *idx_head[IDXMAP_SIZE];
+/* Both tables are the same size, and double once there are more
+ * entries than buckets.
+ */
+#define IDXMAP_MIN	256
+static struct ll_cache **idx_head;
+static struct ll_cache **name_head;
+static unsigned idxmap_size;
+static unsigned idxmap_count;
+
+static int initialized;
+
+static unsigned namehash(const char *str)
+{
+	unsigned hash = 5381;
+
+	while (*str)
+		hash = hash * 33 + (unsigned char)*str++;
+	return hash;
+}
 
 static inline struct ll_cache *idxhead(int idx)
 {
-	return idx_head[idx & (IDXMAP_SIZE - 1)];
+	if (idx_head == NULL)
+		return NULL;
+	return idx_head[idx & (idxmap_size - 1)];
+}
+
+static int ll_map_resize(unsigned size)
+{
+	struct ll_cache **ih, **nh;
+	unsigned i;
+
+	ih = calloc(size, sizeof(*ih));
+	nh = calloc(size, sizeof(*nh));
+	if (ih == NULL || nh == NULL) {
+		free(ih);
+		free(nh);
+		return -1;
+	}
+
+	for (i = 0; i < idxmap_size; i++) {
+		struct ll_cache *im, *next;
+
+		for (im = idx_head[i]; im; im = next) {
+			next = im->idx_next;
+			im->idx_next = ih[im->index & (size - 1)];
+			ih[im->index & (size - 1)] = im;
+			im->name_next = nh[im->name_hash & (size - 1)];
+			nh[im->name_hash & (size - 1)] = im;
+		}
+	}
+
+	free(idx_head);
+	free(name_head);
+	idx_head = ih;
+	name_head = nh;
+	idxmap_size = size;
+	return 0;
+}
+
+static void ll_name_unlink(struct ll_cache *im)
+{
+	struct ll_cache **imp;
+
+	for (imp = &name_head[im->name_hash & (idxmap_size - 1)]; *imp;
+	     imp = &(*imp)->name_next) {
+		if (*imp == im) {
+			*imp = im->name_next;
+			break;
+		}
+	}
+}
+
+static void ll_name_link(struct ll_cache *im, const char *name)
+{
+	unsigned h;
+
+	strncpy(im->name, name, IFNAMSIZ - 1);
+	im->name[IFNAMSIZ - 1] = 0;
+	im->name_hash = namehash(im->name);
+	h = im->name_hash & (idxmap_size - 1);
+	im->name_next = name_head[h];
+	name_head[h] = im;
 }
 
 int ll_remember_index(const struct sockaddr_nl *who,
@@ -52,29 +133,52 @@ int ll_remember_index(const struct sockaddr_nl *who,
 	struct ll_cache *im, **imp;
 	struct rtattr *tb[IFLA_MAX+1];
 
-	if (n->nlmsg_type != RTM_NEWLINK)
+	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
 		return 0;
 
 	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(ifi)))
 		return -1;
 
-	memset(tb, 0, sizeof(tb));
-	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(n));
-	if (tb[IFLA_IFNAME] == NULL)
+	if (idx_head == NULL && ll_map_resize(IDXMAP_MIN) < 0)
 		return 0;
 
-	h = ifi->ifi_index & (IDXMAP_SIZE - 1);
+	h = ifi->ifi_index & (idxmap_size - 1);
 	for (imp = &idx_head[h]; (im=*imp)!=NULL; imp = &im->idx_next)
 		if (im->index == ifi->ifi_index)
 			break;
 
+	if (n->nlmsg_type == RTM_DELLINK) {
+		if (im) {
+			*imp = im->idx_next;
+			ll_name_unlink(im);
+			idxmap_count--;
+			free(im);
+		}
+		return 0;
+	}
+
+	memset(tb, 0, sizeof(tb));
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(n));
+	if (tb[IFLA_IFNAME] == NULL)
+		return 0;
+
 	if (im == NULL) {
+		if (idxmap_count >= idxmap_size &&
+		    ll_map_resize(idxmap_size * 2) == 0)
+			h = ifi->ifi_index & (idxmap_size - 1);
+
 		im = malloc(sizeof(*im));
 		if (im == NULL)
 			return 0;
-		im->idx_next = *imp;
+		im->idx_next = idx_head[h];
 		im->index = ifi->ifi_index;
-		*imp = im;
+		idx_head[h] = im;
+		idxmap_count++;
+		ll_name_link(im, RTA_DATA(tb[IFLA_IFNAME]));
+	} else if (strcmp(im->name, RTA_DATA(tb[IFLA_IFNAME])) != 0) {
+		/* renamed */
+		ll_name_unlink(im);
+		ll_name_link(im, RTA_DATA(tb[IFLA_IFNAME]));
 	}
 
 	im->type = ifi->ifi_type;
@@ -89,7 +193,6 @@ int ll_remember_index(const struct sockaddr_nl *who,
 		im->alen = 0;
 		memset(im->addr, 0, sizeof(im->addr));
 	}
-	strcpy(im->name, RTA_DATA(tb[IFLA_IFNAME]));
 	return 0;
 }
 
@@ -162,40 +265,134 @@ unsigned ll_index_to_addr(unsigned idx, unsigned char *addr,
 	return 0;
 }
 
+static int ll_index_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Collect the indexes of the cached devices whose name matches the
+ * shell pattern (every device for a NULL pattern), in ifindex order.
+ * Returns the count and a malloc'ed array in *list, or -1.
+ */
+int ll_index_list(const char *pattern, int **list)
+{
+	const struct ll_cache *im;
+	unsigned i;
+	int n = 0;
+
+	*list = malloc((idxmap_count + 1) * sizeof(int));
+	if (*list == NULL)
+		return -1;
+
+	for (i = 0; i < idxmap_size; i++) {
+		for (im = idx_head[i]; im; im = im->idx_next) {
+			if (pattern && fnmatch(pattern, im->name, 0) != 0)
+				continue;
+			(*list)[n++] = im->index;
+		}
+	}
+	qsort(*list, n, sizeof(int), ll_index_cmp);
+	return n;
+}
+
+/* Ask the kernel about a single device and cache the answer.  Uses a
+ * handle of its own, so that it never disturbs requests in flight on
+ * the caller's one.
+ */
+static struct rtnl_handle ll_rth = { .fd = -1 };
+
+static unsigned ll_link_get(const char *name)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	ifi;
+		char			buf[64];
+	} req;
+	struct {
+		struct nlmsghdr		n;
+		char			buf[32768];
+	} answer;
+	unsigned idx = 0;
+	int len;
+
+	if (strlen(name) >= IFNAMSIZ)
+		return 0;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_GETLINK;
+	req.ifi.ifi_family = AF_UNSPEC;
+	addattr_l(&req.n, sizeof(req), IFLA_IFNAME, name, strlen(name) + 1);
+
+	if (ll_rth.fd < 0 && rtnl_open(&ll_rth, 0) < 0)
+		return 0;
+
+	/* A missing device is not an error here, so keep rtnl_talk quiet */
+	if (rtnl_send(&ll_rth, &req, req.n.nlmsg_len) < 0)
+		return 0;
+
+	do {
+		len = recv(ll_rth.fd, &answer, sizeof(answer), 0);
+	} while (len < 0 && errno == EINTR);
+
+	if (len >= (int)NLMSG_LENGTH(sizeof(struct ifinfomsg)) &&
+	    answer.n.nlmsg_type == RTM_NEWLINK &&
+	    answer.n.nlmsg_len <= len) {
+		struct ifinfomsg *ifi = NLMSG_DATA(&answer.n);
+
+		ll_remember_index(NULL, &answer.n, NULL);
+		idx = ifi->ifi_index;
+	}
+	return idx;
+}
+
 unsigned ll_name_to_index(const char *name)
 {
-	static char ncache[IFNAMSIZ];
-	static int icache;
 	struct ll_cache *im;
-	int i;
 	unsigned idx;
 
 	if (name == NULL)
 		return 0;
 
-	if (icache && strcmp(name, ncache) == 0)
-		return icache;
+	if (name_head) {
+		unsigned hash = namehash(name);
 
-	for (i=0; i<IDXMAP_SIZE; i++) {
-		for (im = idx_head[i]; im; im = im->idx_next) {
-			if (strcmp(im->name, name) == 0) {
-				icache = im->index;
-				strcpy(ncache, name);
+		for (im = name_head[hash & (idxmap_size - 1)]; im;
+		     im = im->name_next) {
+			if (im->name_hash == hash &&
+			    strcmp(im->name, name) == 0)
 				return im->index;
-			}
 		}
 	}
 
-	idx = if_nametoindex(name);
+	idx = ll_link_get(name);
+	if (idx == 0)
+		idx = if_nametoindex(name);
 	if (idx == 0)
 		sscanf(name, "if%u", &idx);
 	return idx;
 }
 
-int ll_init_map(struct rtnl_handle *rth)
+static void ll_drop_map(void)
 {
-	static int initialized;
+	unsigned i;
+
+	for (i = 0; i < idxmap_size; i++) {
+		while (idx_head[i]) {
+			struct ll_cache *im = idx_head[i];
+
+			idx_head[i] = im->idx_next;
+			free(im);
+		}
+		name_head[i] = NULL;
+	}
+	idxmap_count = 0;
+	initialized = 0;
+}
 
+int ll_init_map(struct rtnl_handle *rth)
+{
 	if (initialized)
 		return 0;
 
@@ -213,3 +410,47 @@ int ll_init_map(struct rtnl_handle *rth)
 
 	return 0;
 }
+
+/* Long running users (batch mode) keep the cache coherent by listening
+ * to link notifications on a private socket and applying them before
+ * each lookup round with ll_map_sync().
+ */
+static struct rtnl_handle ll_watch = { .fd = -1 };
+
+int ll_map_watch(void)
+{
+	if (ll_watch.fd >= 0)
+		return 0;
+	if (rtnl_open(&ll_watch, RTMGRP_LINK) < 0)
+		return -1;
+	if (fcntl(ll_watch.fd, F_SETFL, O_NONBLOCK) < 0) {
+		rtnl_close(&ll_watch);
+		return -1;
+	}
+	return 0;
+}
+
+void ll_map_sync(void)
+{
+	char buf[16384];
+
+	if (ll_watch.fd < 0)
+		return;
+
+	while (1) {
+		struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		int len = recv(ll_watch.fd, buf, sizeof(buf), 0);
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			/* Lost notifications: start over from a fresh dump */
+			if (errno == ENOBUFS && idx_head)
+				ll_drop_map();
+			return;
+		}
+
+		for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len))
+			ll_remember_index(NULL, h, NULL);
+	}
+}
@@ -503,3 +503,20 @@ int rtnl_group_a2n(int *id, char *arg)
 	*id = i;
 	return 0;
 }
+
+/* The databases are loaded on first use; threads that print
+ * concurrently have them loaded up front instead.
+ */
+void rtnl_names_initialize(void)
+{
+	if (!rtnl_rtprot_init)
+		rtnl_rtprot_initialize();
+	if (!rtnl_rtscope_init)
+		rtnl_rtscope_initialize();
+	if (!rtnl_rtrealm_init)
+		rtnl_rtrealm_initialize();
+	if (!rtnl_rttable_init)
+		rtnl_rttable_initialize();
+	if (!rtnl_rtdsfield_init)
+		rtnl_rtdsfield_initialize();
+}
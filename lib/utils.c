@@ -771,3 +771,22 @@ int makeargs(char *line, char *argv[], int maxargs)
 
 	return argc;
 }
+
+void *find_builtin_kind(const struct builtin_kind *kinds, int n,
+			const char *id)
+{
+	int lo = 0, hi = n - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		int cmp = strcmp(id, kinds[mid].id);
+
+		if (cmp == 0)
+			return kinds[mid].util;
+		if (cmp < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
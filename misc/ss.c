@@ -11,12 +11,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <syslog.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <errno.h>
@@ -26,6 +28,7 @@
 #include <dirent.h>
 #include <fnmatch.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include "utils.h"
 #include "rt_names.h"
@@ -202,112 +205,220 @@ struct user_ent {
 	unsigned int	ino;
 	int		pid;
 	int		fd;
-	char		process[0];
+	char		process[16];
 };
 
-#define USER_ENT_HASH_SIZE	256
-struct user_ent *user_ent_hash[USER_ENT_HASH_SIZE];
+/* The owner index is built on the first lookup, so that a filter which
+ * matches nothing never walks /proc.  The walk is spread over threads
+ * taking one process at a time; entries come from per thread chunks,
+ * and the hash is sized to the number of sockets found.
+ */
+#define USER_ENT_CHUNK		4096
+#define USER_ENT_THREADS	16
+
+struct user_pid {
+	int		pid;
+	struct user_ent	*head;
+	struct user_ent	*tail;
+};
 
-static int user_ent_hashfn(unsigned int ino)
+struct user_walker {
+	pthread_t	thread;
+	struct user_ent	*chunk;
+	int		used;
+	unsigned	count;
+};
+
+static struct user_ent **user_ent_hash;
+static unsigned user_ent_hash_size;
+static int user_ent_built;
+static struct user_pid *user_pids;
+static int user_npids;
+static int user_next_pid;
+static char user_root[1024];
+
+static unsigned user_ent_hashfn(unsigned int ino)
 {
-	int val = (ino >> 24) ^ (ino >> 16) ^ (ino >> 8) ^ ino;
+	return (ino ^ (ino >> 16)) & (user_ent_hash_size - 1);
+}
 
-	return val & (USER_ENT_HASH_SIZE - 1);
+static struct user_ent *user_ent_alloc(struct user_walker *w)
+{
+	if (w->chunk == NULL || w->used == USER_ENT_CHUNK) {
+		w->chunk = malloc(USER_ENT_CHUNK * sizeof(struct user_ent));
+		if (!w->chunk)
+			abort();
+		w->used = 0;
+	}
+	w->count++;
+	return &w->chunk[w->used++];
 }
 
-static void user_ent_add(unsigned int ino, const char *process, int pid, int fd)
+static void user_ent_comm(int pid, char *process)
 {
-	struct user_ent *p, **pp;
-	int str_len;
+	char tmp[sizeof(user_root) + 32], buf[64], *p;
+	int fd, n, i;
 
-	str_len = strlen(process) + 1;
-	p = malloc(sizeof(struct user_ent) + str_len);
-	if (!p)
-		abort();
-	p->next = NULL;
-	p->ino = ino;
-	p->pid = pid;
-	p->fd = fd;
-	strcpy(p->process, process);
+	snprintf(tmp, sizeof(tmp), "%s%d/stat", user_root, pid);
+	if ((fd = open(tmp, O_RDONLY)) < 0)
+		return;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return;
+	buf[n] = '\0';
 
-	pp = &user_ent_hash[user_ent_hashfn(ino)];
-	p->next = *pp;
-	*pp = p;
+	if ((p = strchr(buf, '(')) == NULL)
+		return;
+	for (i = 0, p++; *p && *p != ')' && i < 15; i++)
+		process[i] = *p++;
+	process[i] = '\0';
 }
 
-static void user_ent_hash_build(void)
+static void user_ent_walk_pid(struct user_walker *w, struct user_pid *up)
 {
-	const char *root = getenv("PROC_ROOT") ? : "/proc/";
-	struct dirent *d;
-	char name[1024];
-	int nameoff;
-	DIR *dir;
-
-	strcpy(name, root);
-	if (strlen(name) == 0 || name[strlen(name)-1] != '/')
-		strcat(name, "/");
+	const char *pattern = "socket:[";
+	char name[sizeof(user_root) + 32], process[16];
+	struct dirent *d1;
+	DIR *dir1;
+	int pos;
 
-	nameoff = strlen(name);
-
-	dir = opendir(name);
-	if (!dir)
+	pos = snprintf(name, sizeof(name), "%s%d/fd/", user_root, up->pid);
+	if ((dir1 = opendir(name)) == NULL)
 		return;
 
-	while ((d = readdir(dir)) != NULL) {
-		struct dirent *d1;
-		char process[16];
-		int pid, pos;
-		DIR *dir1;
+	process[0] = '\0';
+
+	while ((d1 = readdir(dir1)) != NULL) {
+		struct user_ent *p;
+		unsigned int ino;
+		char lnk[64];
+		int fd;
+		ssize_t link_len;
 		char crap;
 
-		if (sscanf(d->d_name, "%d%c", &pid, &crap) != 1)
+		if (sscanf(d1->d_name, "%d%c", &fd, &crap) != 1)
 			continue;
 
-		sprintf(name + nameoff, "%d/fd/", pid);
-		pos = strlen(name);
-		if ((dir1 = opendir(name)) == NULL)
+		snprintf(name + pos, sizeof(name) - pos, "%d", fd);
+
+		link_len = readlink(name, lnk, sizeof(lnk)-1);
+		if (link_len == -1)
 			continue;
+		lnk[link_len] = '\0';
 
-		process[0] = '\0';
+		if (strncmp(lnk, pattern, strlen(pattern)))
+			continue;
 
-		while ((d1 = readdir(dir1)) != NULL) {
-			const char *pattern = "socket:[";
-			unsigned int ino;
-			char lnk[64];
-			int fd;
-			ssize_t link_len;
+		sscanf(lnk, "socket:[%u]", &ino);
 
-			if (sscanf(d1->d_name, "%d%c", &fd, &crap) != 1)
-				continue;
+		if (process[0] == '\0')
+			user_ent_comm(up->pid, process);
 
-			sprintf(name+pos, "%d", fd);
+		p = user_ent_alloc(w);
+		p->next = NULL;
+		p->ino = ino;
+		p->pid = up->pid;
+		p->fd = fd;
+		strcpy(p->process, process);
+		if (up->tail)
+			up->tail->next = p;
+		else
+			up->head = p;
+		up->tail = p;
+	}
+	closedir(dir1);
+}
 
-			link_len = readlink(name, lnk, sizeof(lnk)-1);
-			if (link_len == -1)
-				continue;
-			lnk[link_len] = '\0';
+static void *user_ent_walk(void *arg)
+{
+	struct user_walker *w = arg;
+	int i;
 
-			if (strncmp(lnk, pattern, strlen(pattern)))
-				continue;
+	while ((i = __sync_fetch_and_add(&user_next_pid, 1)) < user_npids)
+		user_ent_walk_pid(w, &user_pids[i]);
+	return NULL;
+}
+
+static void user_ent_hash_build(void)
+{
+	const char *root = getenv("PROC_ROOT") ? : "/proc/";
+	struct user_walker walkers[USER_ENT_THREADS];
+	struct dirent *d;
+	unsigned total = 0;
+	int i, nthreads, started = 0, alloc = 0;
+	long cpus;
+	DIR *dir;
 
-			sscanf(lnk, "socket:[%u]", &ino);
+	user_ent_built = 1;
+	user_ent_hash_size = 256;
 
-			if (process[0] == '\0') {
-				char tmp[1024];
-				FILE *fp;
+	snprintf(user_root, sizeof(user_root), "%s", root);
+	if (strlen(user_root) == 0 || user_root[strlen(user_root)-1] != '/')
+		strcat(user_root, "/");
 
-				snprintf(tmp, sizeof(tmp), "%s/%d/stat", root, pid);
-				if ((fp = fopen(tmp, "r")) != NULL) {
-					fscanf(fp, "%*d (%[^)])", process);
-					fclose(fp);
-				}
-			}
+	dir = opendir(user_root);
+	if (!dir)
+		goto out;
+
+	while ((d = readdir(dir)) != NULL) {
+		int pid;
+		char crap;
 
-			user_ent_add(ino, process, pid, fd);
+		if (sscanf(d->d_name, "%d%c", &pid, &crap) != 1)
+			continue;
+		if (user_npids == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			user_pids = realloc(user_pids, alloc * sizeof(*user_pids));
+			if (!user_pids)
+				abort();
 		}
-		closedir(dir1);
+		memset(&user_pids[user_npids], 0, sizeof(*user_pids));
+		user_pids[user_npids++].pid = pid;
 	}
 	closedir(dir);
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = cpus > 0 ? cpus : 1;
+	if (nthreads > USER_ENT_THREADS)
+		nthreads = USER_ENT_THREADS;
+	if (nthreads > user_npids)
+		nthreads = user_npids;
+
+	memset(walkers, 0, sizeof(walkers));
+	for (i = 1; i < nthreads; i++) {
+		if (pthread_create(&walkers[i].thread, NULL,
+				   user_ent_walk, &walkers[i]) != 0)
+			break;
+		started++;
+	}
+	user_ent_walk(&walkers[0]);
+	for (i = 1; i <= started; i++)
+		pthread_join(walkers[i].thread, NULL);
+	for (i = 0; i <= started; i++)
+		total += walkers[i].count;
+
+	while (user_ent_hash_size < total)
+		user_ent_hash_size <<= 1;
+out:
+	user_ent_hash = calloc(user_ent_hash_size, sizeof(*user_ent_hash));
+	if (!user_ent_hash)
+		abort();
+
+	/* Link them in the order of a single walk, newest first */
+	for (i = 0; i < user_npids; i++) {
+		struct user_ent *p, *next;
+
+		for (p = user_pids[i].head; p; p = next) {
+			struct user_ent **pp = &user_ent_hash[user_ent_hashfn(p->ino)];
+
+			next = p->next;
+			p->next = *pp;
+			*pp = p;
+		}
+	}
+	free(user_pids);
+	user_pids = NULL;
 }
 
 int find_users(unsigned ino, char *buf, int buflen)
@@ -319,6 +430,9 @@ int find_users(unsigned ino, char *buf, int buflen)
 	if (!ino)
 		return 0;
 
+	if (!user_ent_built)
+		user_ent_hash_build();
+
 	p = user_ent_hash[user_ent_hashfn(ino)];
 	ptr = buf;
 	while (p) {
@@ -1327,6 +1441,20 @@ static char *sprint_bw(char *buf, double bw)
 	return buf;
 }
 
+/* Copy INET_DIAG_INFO into info.  Older kernels send less fields,
+ * and the rest reads as zero.  Returns the length the kernel sent.
+ */
+static int tcp_get_info(const struct rtattr *rta, struct tcp_info *info)
+{
+	int len = RTA_PAYLOAD(rta);
+
+	if (len > sizeof(*info))
+		len = sizeof(*info);
+	memset(info, 0, sizeof(*info));
+	memcpy(info, RTA_DATA(rta), len);
+	return len;
+}
+
 static void tcp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r)
 {
 	struct rtattr * tb[INET_DIAG_MAX+1];
@@ -1357,16 +1485,9 @@ static void tcp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r)
 	}
 
 	if (tb[INET_DIAG_INFO]) {
-		struct tcp_info *info;
-		int len = RTA_PAYLOAD(tb[INET_DIAG_INFO]);
+		struct tcp_info ibuf, *info = &ibuf;
 
-		/* workaround for older kernels with less fields */
-		if (len < sizeof(*info)) {
-			info = alloca(sizeof(*info));
-			memset(info, 0, sizeof(*info));
-			memcpy(info, RTA_DATA(tb[INET_DIAG_INFO]), len);
-		} else
-			info = RTA_DATA(tb[INET_DIAG_INFO]);
+		tcp_get_info(tb[INET_DIAG_INFO], info);
 
 		if (show_options) {
 			if (info->tcpi_options & TCPI_OPT_TIMESTAMPS)
@@ -1486,235 +1607,666 @@ static int tcp_show_sock(struct nlmsghdr *nlh, struct filter *f)
 	return 0;
 }
 
-static int tcp_show_netlink(struct filter *f, FILE *dump_fp, int socktype)
+/* With -I, TCP sockets are dumped every interval, and each socket prints
+ * what changed since the last dump instead of its tcp_info:
+ *
+ *	retrans:+N acked:+BYTES(RATEbps) rcvd:+BYTES(RATEbps) rtt:MS(+MS)
+ *
+ * Sockets seen for the first time print "new", and sockets that went
+ * away print "gone" once and are dropped.  The last counters are kept by
+ * cookie and 4-tuple for at most SAMPLE_MAX sockets; the sockets beyond
+ * that print "new" every time.
+ */
+#define SAMPLE_MAX	(1<<21)
+
+struct tcp_sample
+{
+	struct tcp_sample	*next;
+	__u32			cookie[2];
+	__u32			src[4];
+	__u32			dst[4];
+	__u16			sport;
+	__u16			dport;
+	__u8			family;
+	__u8			state;
+	unsigned		round;
+	__u32			total_retrans;
+	__u32			rtt;
+	__u64			bytes_acked;
+	__u64			bytes_received;
+};
+
+static struct tcp_sample **sample_hash;
+static unsigned sample_hash_size;
+static unsigned sample_count;
+static unsigned sample_round;
+static double sample_elapsed;
+static double sample_interval;
+static unsigned sample_rounds;
+
+static unsigned sample_hashfn(const struct tcp_sample *e)
 {
-	int fd;
-	struct sockaddr_nl nladdr;
-	struct {
-		struct nlmsghdr nlh;
-		struct inet_diag_req r;
-	} req;
-	char    *bc = NULL;
-	int	bclen;
-	struct msghdr msg;
-	struct rtattr rta;
-	char	buf[8192];
-	struct iovec iov[3];
+	unsigned h = e->cookie[0] * 0x9e3779b1U;
 
-	if ((fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG)) < 0)
-		return -1;
+	h ^= e->cookie[1];
+	h ^= ((e->sport << 16) | e->dport) * 0x85ebca6bU;
+	return (h ^ (h >> 16)) & (sample_hash_size - 1);
+}
 
-	memset(&nladdr, 0, sizeof(nladdr));
-	nladdr.nl_family = AF_NETLINK;
+static int sample_match(const struct tcp_sample *a, const struct tcp_sample *b)
+{
+	int alen = a->family == AF_INET ? 4 : 16;
 
-	req.nlh.nlmsg_len = sizeof(req);
-	req.nlh.nlmsg_type = socktype;
-	req.nlh.nlmsg_flags = NLM_F_ROOT|NLM_F_MATCH|NLM_F_REQUEST;
-	req.nlh.nlmsg_pid = 0;
-	req.nlh.nlmsg_seq = 123456;
-	memset(&req.r, 0, sizeof(req.r));
-	req.r.idiag_family = AF_INET;
-	req.r.idiag_states = f->states;
-	if (show_mem) {
-		req.r.idiag_ext |= (1<<(INET_DIAG_MEMINFO-1));
-		req.r.idiag_ext |= (1<<(INET_DIAG_SKMEMINFO-1));
-	}
+	return a->cookie[0] == b->cookie[0] && a->cookie[1] == b->cookie[1] &&
+		a->sport == b->sport && a->dport == b->dport &&
+		a->family == b->family &&
+		memcmp(a->src, b->src, alen) == 0 &&
+		memcmp(a->dst, b->dst, alen) == 0;
+}
 
-	if (show_tcpinfo) {
-		req.r.idiag_ext |= (1<<(INET_DIAG_INFO-1));
-		req.r.idiag_ext |= (1<<(INET_DIAG_VEGASINFO-1));
-		req.r.idiag_ext |= (1<<(INET_DIAG_CONG-1));
-	}
+static void sample_grow(void)
+{
+	struct tcp_sample **old = sample_hash;
+	unsigned old_size = sample_hash_size;
+	unsigned size = old_size ? old_size * 2 : 4096;
+	struct tcp_sample **h;
+	unsigned i;
 
-	iov[0] = (struct iovec){
-		.iov_base = &req,
-		.iov_len = sizeof(req)
-	};
-	if (f->f) {
-		bclen = ssfilter_bytecompile(f->f, &bc);
-		rta.rta_type = INET_DIAG_REQ_BYTECODE;
-		rta.rta_len = RTA_LENGTH(bclen);
-		iov[1] = (struct iovec){ &rta, sizeof(rta) };
-		iov[2] = (struct iovec){ bc, bclen };
-		req.nlh.nlmsg_len += RTA_LENGTH(bclen);
-	}
+	if (size > SAMPLE_MAX || (h = calloc(size, sizeof(*h))) == NULL)
+		return;
+	sample_hash = h;
+	sample_hash_size = size;
+	for (i = 0; i < old_size; i++) {
+		struct tcp_sample *e, *next;
 
-	msg = (struct msghdr) {
-		.msg_name = (void*)&nladdr,
-		.msg_namelen = sizeof(nladdr),
-		.msg_iov = iov,
-		.msg_iovlen = f->f ? 3 : 1,
-	};
+		for (e = old[i]; e; e = next) {
+			struct tcp_sample **slot = &sample_hash[sample_hashfn(e)];
 
-	if (sendmsg(fd, &msg, 0) < 0) {
-		close(fd);
-		return -1;
+			next = e->next;
+			e->next = *slot;
+			*slot = e;
+		}
 	}
+	free(old);
+}
 
-	iov[0] = (struct iovec){
-		.iov_base = buf,
-		.iov_len = sizeof(buf)
-	};
+static void sample_head(const struct tcp_sample *e, int rq, int wq)
+{
+	inet_prefix a;
 
-	while (1) {
-		int status;
-		struct nlmsghdr *h;
-
-		msg = (struct msghdr) {
-			(void*)&nladdr, sizeof(nladdr),
-			iov,	1,
-			NULL,	0,
-			0
-		};
+	if (netid_width)
+		printf("%-*s ", netid_width, "tcp");
+	if (state_width)
+		printf("%-*s ", state_width, sstate_name[e->state]);
 
-		status = recvmsg(fd, &msg, 0);
+	printf("%-6d %-6d ", rq, wq);
 
-		if (status < 0) {
-			if (errno == EINTR)
-				continue;
-			perror("OVERRUN");
-			continue;
+	memset(&a, 0, sizeof(a));
+	a.family = e->family;
+	a.bytelen = e->family == AF_INET ? 4 : 16;
+	memcpy(a.data, e->src, a.bytelen);
+	formatted_print(&a, e->sport);
+	memcpy(a.data, e->dst, a.bytelen);
+	formatted_print(&a, e->dport);
+}
+
+static int tcp_sample_sock(struct nlmsghdr *nlh, struct filter *f)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	struct tcp_info info;
+	struct tcp_sample cur, *e, **slot = NULL;
+	int len = 0;
+
+	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr*)(r+1),
+		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (tb[INET_DIAG_INFO])
+		len = tcp_get_info(tb[INET_DIAG_INFO], &info);
+	else
+		memset(&info, 0, sizeof(info));
+
+	memset(&cur, 0, sizeof(cur));
+	memcpy(cur.cookie, r->id.idiag_cookie, sizeof(cur.cookie));
+	memcpy(cur.src, r->id.idiag_src, sizeof(cur.src));
+	memcpy(cur.dst, r->id.idiag_dst, sizeof(cur.dst));
+	cur.sport = ntohs(r->id.idiag_sport);
+	cur.dport = ntohs(r->id.idiag_dport);
+	cur.family = r->idiag_family;
+	cur.state = r->idiag_state;
+	cur.round = sample_round;
+	cur.total_retrans = info.tcpi_total_retrans;
+	cur.rtt = info.tcpi_rtt;
+	cur.bytes_acked = info.tcpi_bytes_acked;
+	cur.bytes_received = info.tcpi_bytes_received;
+
+	if (sample_count >= sample_hash_size)
+		sample_grow();
+	e = NULL;
+	if (sample_hash_size) {
+		slot = &sample_hash[sample_hashfn(&cur)];
+		for (e = *slot; e; e = e->next) {
+			if (sample_match(e, &cur))
+				break;
 		}
-		if (status == 0) {
-			fprintf(stderr, "EOF on netlink\n");
-			close(fd);
-			return 0;
+	}
+
+	sample_head(&cur, r->idiag_rqueue, r->idiag_wqueue);
+
+	if (e == NULL) {
+		printf(" new");
+		if (cur.rtt)
+			printf(" rtt:%g", (double)cur.rtt/1000);
+		printf("\n");
+		if (slot && sample_count < SAMPLE_MAX &&
+		    (e = malloc(sizeof(*e))) != NULL) {
+			cur.next = *slot;
+			*e = cur;
+			*slot = e;
+			sample_count++;
 		}
+		return 0;
+	}
 
-		if (dump_fp)
-			fwrite(buf, 1, NLMSG_ALIGN(status), dump_fp);
+	printf(" retrans:+%u", cur.total_retrans - e->total_retrans);
+	/* The byte counters came with 4.1 */
+	if (len >= offsetof(struct tcp_info, tcpi_segs_out)) {
+		__u64 acked = cur.bytes_acked - e->bytes_acked;
+		__u64 rcvd = cur.bytes_received - e->bytes_received;
+		char b1[64];
 
-		h = (struct nlmsghdr*)buf;
-		while (NLMSG_OK(h, status)) {
-			int err;
-			struct inet_diag_msg *r = NLMSG_DATA(h);
+		printf(" acked:+%llu", (unsigned long long)acked);
+		if (sample_elapsed > 0)
+			printf("(%sbps)",
+			       sprint_bw(b1, acked * 8. / sample_elapsed));
+		printf(" rcvd:+%llu", (unsigned long long)rcvd);
+		if (sample_elapsed > 0)
+			printf("(%sbps)",
+			       sprint_bw(b1, rcvd * 8. / sample_elapsed));
+	}
+	printf(" rtt:%g(%+g)\n", (double)cur.rtt/1000,
+	       ((double)cur.rtt - e->rtt)/1000);
 
-			if (/*h->nlmsg_pid != rth->local.nl_pid ||*/
-			    h->nlmsg_seq != 123456)
-				goto skip_it;
+	cur.next = e->next;
+	*e = cur;
+	return 0;
+}
 
-			if (h->nlmsg_type == NLMSG_DONE) {
-				close(fd);
-				return 0;
-			}
-			if (h->nlmsg_type == NLMSG_ERROR) {
-				struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
-				if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
-					fprintf(stderr, "ERROR truncated\n");
-				} else {
-					errno = -err->error;
-					if (errno == EOPNOTSUPP) {
-						close(fd);
-						return -1;
-					}
-					perror("TCPDIAG answers");
-				}
-				close(fd);
-				return 0;
-			}
-			if (!dump_fp) {
-				if (!(f->families & (1<<r->idiag_family))) {
-					h = NLMSG_NEXT(h, status);
-					continue;
-				}
-				err = tcp_show_sock(h, NULL);
-				if (err < 0) {
-					close(fd);
-					return err;
-				}
-			}
+static void sample_sweep(void)
+{
+	struct tcp_sample **ep, *e;
+	unsigned i;
 
-skip_it:
-			h = NLMSG_NEXT(h, status);
-		}
-		if (msg.msg_flags & MSG_TRUNC) {
-			fprintf(stderr, "Message truncated\n");
-			continue;
-		}
-		if (status) {
-			fprintf(stderr, "!!!Remnant of size %d\n", status);
-			exit(1);
+	for (i = 0; i < sample_hash_size; i++) {
+		for (ep = &sample_hash[i]; (e = *ep) != NULL; ) {
+			if (e->round == sample_round) {
+				ep = &e->next;
+				continue;
+			}
+			sample_head(e, 0, 0);
+			printf(" gone\n");
+			*ep = e->next;
+			free(e);
+			sample_count--;
 		}
 	}
-	close(fd);
-	return 0;
 }
 
-static int tcp_show_netlink_file(struct filter *f)
+/* inet_diag dumps share one handle and the receive ring of libnetlink,
+ * so a recvmmsg call drains several 32K skbs.  With more than one CPU a
+ * receiver thread copies the dump into chunks while the caller formats
+ * them, so that the kernel walk and the printing overlap.  Chunks are
+ * recycled; at most DIAG_QUEUE of them wait for the formatter, past
+ * that the receiver stops reading and the kernel holds the rest of the
+ * dump.  main() gives stdout a large buffer when it is not a terminal.
+ */
+#define DIAG_CHUNK	(256 * 1024)
+#define DIAG_QUEUE	4
+
+struct diag_chunk
 {
-	FILE	*fp;
-	char	buf[8192];
+	struct diag_chunk	*next;
+	int			len;
+	char			data[DIAG_CHUNK];
+};
 
-	if ((fp = fopen(getenv("TCPDIAG_FILE"), "r")) == NULL) {
-		perror("fopen($TCPDIAG_FILE)");
-		return -1;
+struct diag_dump
+{
+	struct filter		*f;
+	FILE			*dump_fp;
+	int			(*show)(struct nlmsghdr *h, struct filter *f);
+	/* SOCK_DIAG_BY_FAMILY answers ENOENT when the protocol module is
+	 * missing, and kernels before 3.3 answer EINVAL.
+	 */
+	int			by_family;
+	/* what the kernel cannot filter is left to show() */
+	struct filter		*user_f;
+	unsigned		socks;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct diag_chunk	*head;
+	struct diag_chunk	*tail;
+	struct diag_chunk	*cur;
+	struct diag_chunk	*free;
+	int			queued;
+	int			finished;
+	int			status;
+	int			error;
+};
+
+static struct rtnl_handle diag_rth = { .fd = -1 };
+static int dump_stats;
+
+static int diag_dump_msg(const struct sockaddr_nl *who,
+			 struct nlmsghdr *h, void *arg)
+{
+	struct diag_dump *d = arg;
+	struct inet_diag_msg *r = NLMSG_DATA(h);
+
+	d->socks++;
+	if (d->dump_fp) {
+		fwrite(h, 1, NLMSG_ALIGN(h->nlmsg_len), d->dump_fp);
+		return 0;
 	}
+	/* unix_diag_msg starts with the family as well */
+	if (r->idiag_family != AF_UNIX &&
+	    !(d->f->families & (1<<r->idiag_family)))
+		return 0;
+	return d->show(h, d->user_f);
+}
 
-	while (1) {
-		int status, err;
-		struct nlmsghdr *h = (struct nlmsghdr*)buf;
+static struct diag_chunk *diag_get_chunk(struct diag_dump *d)
+{
+	struct diag_chunk *c;
 
-		status = fread(buf, 1, sizeof(*h), fp);
-		if (status < 0) {
-			perror("Reading header from $TCPDIAG_FILE");
-			return -1;
-		}
-		if (status != sizeof(*h)) {
-			perror("Unexpected EOF reading $TCPDIAG_FILE");
-			return -1;
-		}
+	pthread_mutex_lock(&d->lock);
+	c = d->free;
+	if (c)
+		d->free = c->next;
+	pthread_mutex_unlock(&d->lock);
+	if (c == NULL && (c = malloc(sizeof(*c))) == NULL)
+		return NULL;
+	c->next = NULL;
+	c->len = 0;
+	return c;
+}
 
-		status = fread(h+1, 1, NLMSG_ALIGN(h->nlmsg_len-sizeof(*h)), fp);
+static void diag_publish(struct diag_dump *d)
+{
+	struct diag_chunk *c = d->cur;
 
-		if (status < 0) {
-			perror("Reading $TCPDIAG_FILE");
-			return -1;
-		}
-		if (status + sizeof(*h) < h->nlmsg_len) {
-			perror("Unexpected EOF reading $TCPDIAG_FILE");
-			return -1;
-		}
+	if (c == NULL)
+		return;
+	d->cur = NULL;
 
-		/* The only legal exit point */
-		if (h->nlmsg_type == NLMSG_DONE)
-			return 0;
+	pthread_mutex_lock(&d->lock);
+	while (d->queued >= DIAG_QUEUE)
+		pthread_cond_wait(&d->cond, &d->lock);
+	if (d->tail)
+		d->tail->next = c;
+	else
+		d->head = c;
+	d->tail = c;
+	d->queued++;
+	pthread_cond_signal(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+}
 
-		if (h->nlmsg_type == NLMSG_ERROR) {
-			struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
-			if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
-				fprintf(stderr, "ERROR truncated\n");
-			} else {
-				errno = -err->error;
-				perror("TCPDIAG answered");
-			}
-			return -1;
-		}
+static int diag_collect(const struct sockaddr_nl *who,
+			struct nlmsghdr *h, void *arg)
+{
+	struct diag_dump *d = arg;
+	int len = NLMSG_ALIGN(h->nlmsg_len);
 
-		err = tcp_show_sock(h, f);
-		if (err < 0)
-			return err;
+	if (len > DIAG_CHUNK)
+		return 0;
+	if (d->cur && d->cur->len + len > DIAG_CHUNK)
+		diag_publish(d);
+	if (d->cur == NULL && (d->cur = diag_get_chunk(d)) == NULL) {
+		perror("Cannot allocate dump chunk");
+		return -1;
 	}
+	memcpy(d->cur->data + d->cur->len, h, h->nlmsg_len);
+	d->cur->len += len;
+	return 0;
 }
 
-static int tcp_show(struct filter *f, int socktype)
+static void *diag_receiver(void *arg)
 {
-	FILE *fp = NULL;
-	char *buf = NULL;
-	int bufsize = 64*1024;
+	struct diag_dump *d = arg;
+	int status;
 
-	dg_proto = TCP_PROTO;
+	status = rtnl_dump_filter(&diag_rth, diag_collect, d);
+	diag_publish(d);
 
-	if (getenv("TCPDIAG_FILE"))
-		return tcp_show_netlink_file(f);
+	pthread_mutex_lock(&d->lock);
+	d->status = status;
+	d->error = errno;
+	d->finished = 1;
+	pthread_cond_signal(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+	return NULL;
+}
 
-	if (!getenv("PROC_NET_TCP") && !getenv("PROC_ROOT")
-	    && tcp_show_netlink(f, NULL, socktype) == 0)
+static int diag_format(struct diag_dump *d)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	pthread_t thread;
+	int err = 0;
+
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->cond, NULL);
+	if (pthread_create(&thread, NULL, diag_receiver, d) != 0) {
+		d->status = rtnl_dump_filter(&diag_rth, diag_dump_msg, d);
+		d->error = errno;
 		return 0;
+	}
 
-	/* Sigh... We have to parse /proc/net/tcp... */
+	for (;;) {
+		struct diag_chunk *c;
+		int off;
 
+		pthread_mutex_lock(&d->lock);
+		while (d->head == NULL && !d->finished)
+			pthread_cond_wait(&d->cond, &d->lock);
+		c = d->head;
+		if (c) {
+			d->head = c->next;
+			if (d->head == NULL)
+				d->tail = NULL;
+			d->queued--;
+			pthread_cond_signal(&d->cond);
+		}
+		pthread_mutex_unlock(&d->lock);
+		if (c == NULL)
+			break;
 
-	/* Estimate amount of sockets and try to allocate
+		for (off = 0; off < c->len && err >= 0; ) {
+			struct nlmsghdr *h = (struct nlmsghdr *)(c->data + off);
+
+			err = diag_dump_msg(&nladdr, h, d);
+			off += NLMSG_ALIGN(h->nlmsg_len);
+		}
+
+		pthread_mutex_lock(&d->lock);
+		c->next = d->free;
+		d->free = c;
+		pthread_mutex_unlock(&d->lock);
+	}
+	pthread_join(thread, NULL);
+
+	while (d->free) {
+		struct diag_chunk *c = d->free;
+
+		d->free = c->next;
+		free(c);
+	}
+	return err;
+}
+
+/* Receive and print the dump the caller asked for on diag_rth.  Returns
+ * -1 only when the kernel does not know the request, so that the caller
+ * can fall back to /proc.
+ */
+static int diag_run(struct diag_dump *d, const char *what)
+{
+	struct timeval start, end;
+	long cpus;
+	int err;
+
+	gettimeofday(&start, NULL);
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 1 && !d->dump_fp) {
+		err = diag_format(d);
+	} else {
+		err = d->status = rtnl_dump_filter(&diag_rth, diag_dump_msg, d);
+		d->error = errno;
+	}
+	gettimeofday(&end, NULL);
+
+	if (dump_stats) {
+		double t = (end.tv_sec - start.tv_sec) +
+			(end.tv_usec - start.tv_usec) / 1000000.;
+
+		fprintf(stderr, "Dumped %u sockets in %u receive calls, %.0f sockets/s\n",
+			d->socks, diag_rth.dump_recvs, t > 0 ? d->socks / t : 0);
+	}
+
+	if (d->dump_fp) {
+		struct {
+			struct nlmsghdr nlh;
+			int		status;
+		} done = {
+			.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(int)),
+			.nlh.nlmsg_type = NLMSG_DONE,
+			.nlh.nlmsg_seq = diag_rth.dump,
+		};
+
+		fwrite(&done, 1, sizeof(done), d->dump_fp);
+	}
+
+	if (err < 0 && d->status == 0)
+		return err;
+	if (d->status < 0) {
+		/* An old kernel without this dump */
+		if (d->error == EOPNOTSUPP ||
+		    (d->by_family &&
+		     (d->error == ENOENT || d->error == EINVAL)))
+			return -1;
+		fflush(stdout);
+		errno = d->error;
+		perror(what);
+	}
+	return 0;
+}
+
+static int diag_open(void)
+{
+	if (diag_rth.fd >= 0)
+		return 0;
+	if (rtnl_open_byproto(&diag_rth, 0, NETLINK_INET_DIAG) < 0)
+		return -1;
+	diag_rth.flags |= RTNL_HANDLE_F_QUIET;
+	return 0;
+}
+
+/* Send an inet_diag request with the filter compiled to bytecode, so
+ * that the kernel skips the sockets we would not print anyway.
+ */
+static int diag_send(struct nlmsghdr *n, struct filter *f)
+{
+	char	*bc = NULL;
+	int	bclen;
+	struct rtattr rta;
+	struct iovec iov[3];
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct msghdr msg;
+	int	err;
+
+	n->nlmsg_flags = NLM_F_ROOT|NLM_F_MATCH|NLM_F_REQUEST;
+	n->nlmsg_pid = 0;
+	n->nlmsg_seq = diag_rth.dump = ++diag_rth.seq;
+
+	iov[0] = (struct iovec){
+		.iov_base = n,
+		.iov_len = n->nlmsg_len
+	};
+	if (f->f) {
+		bclen = ssfilter_bytecompile(f->f, &bc);
+		rta.rta_type = INET_DIAG_REQ_BYTECODE;
+		rta.rta_len = RTA_LENGTH(bclen);
+		iov[1] = (struct iovec){ &rta, sizeof(rta) };
+		iov[2] = (struct iovec){ bc, bclen };
+		n->nlmsg_len += RTA_LENGTH(bclen);
+	}
+
+	msg = (struct msghdr) {
+		.msg_name = (void*)&nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = iov,
+		.msg_iovlen = f->f ? 3 : 1,
+	};
+
+	err = sendmsg(diag_rth.fd, &msg, 0);
+	free(bc);
+	return err < 0 ? -1 : 0;
+}
+
+static int tcp_show_netlink(struct filter *f, FILE *dump_fp, int socktype)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct inet_diag_req r;
+	} req;
+	struct diag_dump d;
+
+	if (diag_open() < 0)
+		return -1;
+
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = socktype;
+	memset(&req.r, 0, sizeof(req.r));
+	req.r.idiag_family = AF_INET;
+	req.r.idiag_states = f->states;
+	if (show_mem) {
+		req.r.idiag_ext |= (1<<(INET_DIAG_MEMINFO-1));
+		req.r.idiag_ext |= (1<<(INET_DIAG_SKMEMINFO-1));
+	}
+
+	if (show_tcpinfo) {
+		req.r.idiag_ext |= (1<<(INET_DIAG_INFO-1));
+		req.r.idiag_ext |= (1<<(INET_DIAG_VEGASINFO-1));
+		req.r.idiag_ext |= (1<<(INET_DIAG_CONG-1));
+	}
+	if (sample_interval)
+		req.r.idiag_ext = (1<<(INET_DIAG_INFO-1));
+
+	if (diag_send(&req.nlh, f) < 0)
+		return -1;
+
+	memset(&d, 0, sizeof(d));
+	d.f = f;
+	d.dump_fp = dump_fp;
+	d.show = sample_interval ? tcp_sample_sock : tcp_show_sock;
+	return diag_run(&d, "TCPDIAG answers");
+}
+
+static int tcp_sample(struct filter *f)
+{
+	struct timeval last, now;
+	double next, t;
+
+	if (getenv("PROC_NET_TCP") || getenv("PROC_ROOT")) {
+		fprintf(stderr, "ss: sampling needs inet_diag, not /proc\n");
+		return -1;
+	}
+
+	gettimeofday(&last, NULL);
+	next = last.tv_sec + last.tv_usec / 1000000.;
+	for (;;) {
+		gettimeofday(&now, NULL);
+		sample_elapsed = (now.tv_sec - last.tv_sec) +
+			(now.tv_usec - last.tv_usec) / 1000000.;
+		last = now;
+		sample_round++;
+
+		printf("Time: %lu.%06lu\n", (unsigned long)now.tv_sec,
+		       (unsigned long)now.tv_usec);
+		if (tcp_show_netlink(f, NULL, TCPDIAG_GETSOCK) < 0) {
+			fprintf(stderr, "ss: sampling needs inet_diag\n");
+			return -1;
+		}
+		sample_sweep();
+		fflush(stdout);
+
+		if (sample_rounds && sample_round >= sample_rounds)
+			break;
+
+		/* Keep to the schedule, skipping ticks a slow dump missed */
+		gettimeofday(&now, NULL);
+		t = now.tv_sec + now.tv_usec / 1000000.;
+		next += sample_interval;
+		while (next < t)
+			next += sample_interval;
+		usleep((next - t) * 1000000);
+	}
+	return 0;
+}
+
+static int tcp_show_netlink_file(struct filter *f)
+{
+	FILE	*fp;
+	char	buf[8192];
+
+	if ((fp = fopen(getenv("TCPDIAG_FILE"), "r")) == NULL) {
+		perror("fopen($TCPDIAG_FILE)");
+		return -1;
+	}
+
+	while (1) {
+		int status, err;
+		struct nlmsghdr *h = (struct nlmsghdr*)buf;
+
+		status = fread(buf, 1, sizeof(*h), fp);
+		if (status < 0) {
+			perror("Reading header from $TCPDIAG_FILE");
+			return -1;
+		}
+		if (status != sizeof(*h)) {
+			perror("Unexpected EOF reading $TCPDIAG_FILE");
+			return -1;
+		}
+
+		status = fread(h+1, 1, NLMSG_ALIGN(h->nlmsg_len-sizeof(*h)), fp);
+
+		if (status < 0) {
+			perror("Reading $TCPDIAG_FILE");
+			return -1;
+		}
+		if (status + sizeof(*h) < h->nlmsg_len) {
+			perror("Unexpected EOF reading $TCPDIAG_FILE");
+			return -1;
+		}
+
+		/* The only legal exit point */
+		if (h->nlmsg_type == NLMSG_DONE)
+			return 0;
+
+		if (h->nlmsg_type == NLMSG_ERROR) {
+			struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
+			if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+				fprintf(stderr, "ERROR truncated\n");
+			} else {
+				errno = -err->error;
+				perror("TCPDIAG answered");
+			}
+			return -1;
+		}
+
+		err = tcp_show_sock(h, f);
+		if (err < 0)
+			return err;
+	}
+}
+
+static int tcp_show(struct filter *f, int socktype)
+{
+	FILE *fp = NULL;
+	char *buf = NULL;
+	int bufsize = 64*1024;
+
+	dg_proto = TCP_PROTO;
+
+	if (getenv("TCPDIAG_FILE"))
+		return tcp_show_netlink_file(f);
+
+	if (!getenv("PROC_NET_TCP") && !getenv("PROC_ROOT")
+	    && tcp_show_netlink(f, NULL, socktype) == 0)
+		return 0;
+
+	/* Sigh... We have to parse /proc/net/tcp... */
+
+
+	/* Estimate amount of sockets and try to allocate
 	 * huge buffer to read all the table at one read.
 	 * Limit it by 16MB though. The assumption is: as soon as
 	 * kernel was able to hold information about N connections,
@@ -1866,46 +2418,95 @@ int dgram_show_line(char *line, const struct filter *f, int family)
 }
 
 
-int udp_show(struct filter *f)
+static int dgram_show_sock(struct nlmsghdr *nlh, struct filter *f)
 {
-	FILE *fp = NULL;
-
-	dg_proto = UDP_PROTO;
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct tcpstat s;
 
-	if (f->families&(1<<AF_INET)) {
-		if ((fp = net_udp_open()) == NULL)
-			goto outerr;
-		if (generic_record_read(fp, dgram_show_line, f, AF_INET))
-			goto outerr;
-		fclose(fp);
+	s.state = r->idiag_state;
+	s.local.family = s.remote.family = r->idiag_family;
+	s.lport = ntohs(r->id.idiag_sport);
+	s.rport = ntohs(r->id.idiag_dport);
+	if (s.local.family == AF_INET) {
+		s.local.bytelen = s.remote.bytelen = 4;
+	} else {
+		s.local.bytelen = s.remote.bytelen = 16;
 	}
+	memcpy(s.local.data, r->id.idiag_src, s.local.bytelen);
+	memcpy(s.remote.data, r->id.idiag_dst, s.local.bytelen);
 
-	if ((f->families&(1<<AF_INET6)) &&
-	    (fp = net_udp6_open()) != NULL) {
-		if (generic_record_read(fp, dgram_show_line, f, AF_INET6))
-			goto outerr;
-		fclose(fp);
+	if (f && f->f && run_ssfilter(f->f, &s) == 0)
+		return 0;
+
+	if (netid_width)
+		printf("%-*s ", netid_width, dg_proto);
+	if (state_width)
+		printf("%-*s ", state_width, sstate_name[s.state]);
+
+	printf("%-6d %-6d ", r->idiag_rqueue, r->idiag_wqueue);
+
+	formatted_print(&s.local, s.lport);
+	formatted_print(&s.remote, s.rport);
+
+	if (show_users) {
+		char ubuf[4096];
+		if (find_users(r->idiag_inode, ubuf, sizeof(ubuf)) > 0)
+			printf(" users:(%s)", ubuf);
 	}
+
+	printf("\n");
+
 	return 0;
+}
 
-outerr:
-	do {
-		int saved_errno = errno;
-		if (fp)
-			fclose(fp);
-		errno = saved_errno;
+/* UDP sockets are dumped by SOCK_DIAG_BY_FAMILY, one family per
+ * request, with the same bytecode as TCP.  Returns -1 when the kernel
+ * has no diag module for the protocol, and the caller reads /proc
+ * instead.
+ */
+static int dgram_show_netlink(struct filter *f, int family, int protocol)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct inet_diag_req_v2 r;
+	} req;
+	struct diag_dump d;
+
+	if (diag_open() < 0)
 		return -1;
-	} while (0);
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	req.r.sdiag_family = family;
+	req.r.sdiag_protocol = protocol;
+	req.r.idiag_states = f->states;
+
+	if (diag_send(&req.nlh, f) < 0)
+		return -1;
+
+	memset(&d, 0, sizeof(d));
+	d.f = f;
+	d.show = dgram_show_sock;
+	d.by_family = 1;
+	return diag_run(&d, "UDPDIAG answers");
 }
 
-int raw_show(struct filter *f)
+/* -e reads /proc, where sk= is the kernel socket pointer rather than
+ * the diag cookie.  RAW has no protocol to ask for: raw_diag matches
+ * sdiag_protocol against the socket's own, so pass 0 for /proc only.
+ */
+static int dgram_show(struct filter *f, int protocol,
+		      FILE *(*proc_open)(void), FILE *(*proc6_open)(void),
+		      const char *env)
 {
 	FILE *fp = NULL;
+	int netlink = protocol && !show_details &&
+		      !getenv(env) && !getenv("PROC_ROOT");
 
-	dg_proto = RAW_PROTO;
-
-	if (f->families&(1<<AF_INET)) {
-		if ((fp = net_raw_open()) == NULL)
+	if (f->families&(1<<AF_INET) &&
+	    !(netlink && dgram_show_netlink(f, AF_INET, protocol) == 0)) {
+		if ((fp = proc_open()) == NULL)
 			goto outerr;
 		if (generic_record_read(fp, dgram_show_line, f, AF_INET))
 			goto outerr;
@@ -1913,7 +2514,8 @@ int raw_show(struct filter *f)
 	}
 
 	if ((f->families&(1<<AF_INET6)) &&
-	    (fp = net_raw6_open()) != NULL) {
+	    !(netlink && dgram_show_netlink(f, AF_INET6, protocol) == 0) &&
+	    (fp = proc6_open()) != NULL) {
 		if (generic_record_read(fp, dgram_show_line, f, AF_INET6))
 			goto outerr;
 		fclose(fp);
@@ -1930,10 +2532,24 @@ outerr:
 	} while (0);
 }
 
+int udp_show(struct filter *f)
+{
+	dg_proto = UDP_PROTO;
+	return dgram_show(f, IPPROTO_UDP, net_udp_open, net_udp6_open,
+			  "PROC_NET_UDP");
+}
+
+int raw_show(struct filter *f)
+{
+	dg_proto = RAW_PROTO;
+	return dgram_show(f, 0, net_raw_open, net_raw6_open,
+			  "PROC_NET_RAW");
+}
+
 
 struct unixstat
 {
-	struct unixstat *next;
+	struct unixstat *next;		/* in unix_hash */
 	int ino;
 	int peer;
 	int rq;
@@ -1949,226 +2565,304 @@ int unix_state_map[] = { SS_CLOSE, SS_SYN_SENT,
 			 SS_ESTABLISHED, SS_CLOSING };
 
 
-#define MAX_UNIX_REMEMBER (1024*1024/sizeof(struct unixstat))
+/* Unix sockets and their names live in large chunks which are freed all
+ * at once, and are hashed by inode to find the name of the peer.
+ */
+struct unix_arena
+{
+	struct unix_arena *next;
+	size_t		  size;
+	size_t		  used;
+	char		  data[0];
+};
+
+#define UNIX_ARENA_CHUNK	(256 * 1024)
 
-void unix_list_free(struct unixstat *list)
+static struct unix_arena *unix_arena;
+static struct unixstat **unix_hash;
+static unsigned unix_hash_size;
+static unsigned unix_count;
+/* sockets printed at the end: all of them when sorted, else the ones
+ * whose peer was not known yet
+ */
+static struct unixstat **unix_later;
+static unsigned unix_later_len;
+static unsigned unix_later_size;
+
+static void *unix_arena_alloc(size_t len)
 {
-	while (list) {
-		struct unixstat *s = list;
-		list = list->next;
-		if (s->name)
-			free(s->name);
-		free(s);
+	struct unix_arena *a = unix_arena;
+	void *p;
+
+	len = (len + 7) & ~7;
+	if (a == NULL || a->used + len > a->size) {
+		size_t size = len > UNIX_ARENA_CHUNK ? len : UNIX_ARENA_CHUNK;
+
+		a = malloc(sizeof(*a) + size);
+		if (a == NULL)
+			return NULL;
+		a->size = size;
+		a->used = 0;
+		a->next = unix_arena;
+		unix_arena = a;
 	}
+	p = a->data + a->used;
+	a->used += len;
+	return p;
 }
 
-void unix_list_print(struct unixstat *list, struct filter *f)
+static void unix_store_free(void)
 {
-	struct unixstat *s;
-	char *peer;
+	while (unix_arena) {
+		struct unix_arena *a = unix_arena;
 
-	for (s = list; s; s = s->next) {
-		if (!(f->states & (1<<s->state)))
-			continue;
-		if (s->type == SOCK_STREAM && !(f->dbs&(1<<UNIX_ST_DB)))
-			continue;
-		if (s->type == SOCK_DGRAM && !(f->dbs&(1<<UNIX_DG_DB)))
-			continue;
+		unix_arena = a->next;
+		free(a);
+	}
+	free(unix_hash);
+	unix_hash = NULL;
+	unix_hash_size = unix_count = 0;
+	free(unix_later);
+	unix_later = NULL;
+	unix_later_len = unix_later_size = 0;
+}
 
-		peer = "*";
-		if (s->peer) {
-			struct unixstat *p;
-			for (p = list; p; p = p->next) {
-				if (s->peer == p->ino)
-					break;
-			}
-			if (!p) {
-				peer = "?";
-			} else {
-				peer = p->name ? : "*";
-			}
+static unsigned unix_hashfn(int ino)
+{
+	return ((unsigned)ino * 0x9e3779b1U >> 8) & (unix_hash_size - 1);
+}
+
+static struct unixstat *unix_lookup(int ino)
+{
+	struct unixstat *u;
+
+	if (unix_hash_size == 0)
+		return NULL;
+	for (u = unix_hash[unix_hashfn(ino)]; u; u = u->next) {
+		if (u->ino == ino)
+			return u;
+	}
+	return NULL;
+}
+
+static int unix_store(struct unixstat *u)
+{
+	struct unixstat **slot;
+
+	if (unix_count >= unix_hash_size) {
+		unsigned old_size = unix_hash_size;
+		unsigned size = old_size ? old_size * 2 : 4096;
+		struct unixstat **old = unix_hash;
+		unsigned i;
+
+		unix_hash = calloc(size, sizeof(*unix_hash));
+		if (unix_hash == NULL) {
+			unix_hash = old;
+			return -1;
 		}
+		unix_hash_size = size;
+		for (i = 0; i < old_size; i++) {
+			struct unixstat *e, *next;
 
-		if (f->f) {
-			struct tcpstat tst;
-			tst.local.family = AF_UNIX;
-			tst.remote.family = AF_UNIX;
-			memcpy(tst.local.data, &s->name, sizeof(s->name));
-			if (strcmp(peer, "*") == 0)
-				memset(tst.remote.data, 0, sizeof(peer));
-			else
-				memcpy(tst.remote.data, &peer, sizeof(peer));
-			if (run_ssfilter(f->f, &tst) == 0)
-				continue;
+			for (e = old[i]; e; e = next) {
+				next = e->next;
+				slot = &unix_hash[unix_hashfn(e->ino)];
+				e->next = *slot;
+				*slot = e;
+			}
 		}
+		free(old);
+	}
+	slot = &unix_hash[unix_hashfn(u->ino)];
+	u->next = *slot;
+	*slot = u;
+	unix_count++;
+	return 0;
+}
 
-		if (netid_width)
-			printf("%-*s ", netid_width,
-			       s->type == SOCK_STREAM ? "u_str" : "u_dgr");
-		if (state_width)
-			printf("%-*s ", state_width, sstate_name[s->state]);
-		printf("%-6d %-6d ", s->rq, s->wq);
-		printf("%*s %-*d %*s %-*d",
-		       addr_width, s->name ? : "*", serv_width, s->ino,
-		       addr_width, peer, serv_width, s->peer);
-		if (show_users) {
-			char ubuf[4096];
-			if (find_users(s->ino, ubuf, sizeof(ubuf)) > 0)
-				printf(" users:(%s)", ubuf);
+static int unix_defer(struct unixstat *u)
+{
+	if (unix_later_len == unix_later_size) {
+		unsigned size = unix_later_size ? unix_later_size * 2 : 4096;
+		struct unixstat **later;
+
+		later = realloc(unix_later, size * sizeof(*later));
+		if (later == NULL)
+			return -1;
+		unix_later = later;
+		unix_later_size = size;
+	}
+	unix_later[unix_later_len++] = u;
+	return 0;
+}
+
+static int unix_cmp(const void *a, const void *b)
+{
+	const struct unixstat *u = *(struct unixstat * const *)a;
+	const struct unixstat *v = *(struct unixstat * const *)b;
+
+	if (u->type != v->type)
+		return u->type < v->type ? -1 : 1;
+	if (u->ino != v->ino)
+		return u->ino < v->ino ? -1 : 1;
+	return 0;
+}
+
+static void unix_print(struct unixstat *s, struct filter *f)
+{
+	char *peer;
+
+	if (!(f->states & (1<<s->state)))
+		return;
+	if (s->type == SOCK_STREAM && !(f->dbs&(1<<UNIX_ST_DB)))
+		return;
+	if (s->type == SOCK_DGRAM && !(f->dbs&(1<<UNIX_DG_DB)))
+		return;
+
+	peer = "*";
+	if (s->peer) {
+		struct unixstat *p = unix_lookup(s->peer);
+
+		if (!p) {
+			peer = "?";
+		} else {
+			peer = p->name ? : "*";
 		}
-		printf("\n");
 	}
+
+	/* The "ports" of unix sockets are their inodes */
+	if (f->f) {
+		struct tcpstat tst;
+		char *none = NULL;
+
+		tst.local.family = AF_UNIX;
+		tst.remote.family = AF_UNIX;
+		tst.lport = s->ino;
+		tst.rport = s->peer;
+		memcpy(tst.local.data, &s->name, sizeof(s->name));
+		if (strcmp(peer, "*") == 0)
+			memcpy(tst.remote.data, &none, sizeof(none));
+		else
+			memcpy(tst.remote.data, &peer, sizeof(peer));
+		if (run_ssfilter(f->f, &tst) == 0)
+			return;
+	}
+
+	if (netid_width)
+		printf("%-*s ", netid_width,
+		       s->type == SOCK_STREAM ? "u_str" : "u_dgr");
+	if (state_width)
+		printf("%-*s ", state_width, sstate_name[s->state]);
+	printf("%-6d %-6d ", s->rq, s->wq);
+	printf("%*s %-*d %*s %-*d",
+	       addr_width, s->name ? : "*", serv_width, s->ino,
+	       addr_width, peer, serv_width, s->peer);
+	if (show_users) {
+		char ubuf[4096];
+		if (find_users(s->ino, ubuf, sizeof(ubuf)) > 0)
+			printf(" users:(%s)", ubuf);
+	}
+	printf("\n");
 }
 
+/* The netlink dump needs no sorting, so a socket is printed as soon as
+ * the name of its peer is known, and only the others wait for the end
+ * of the dump.
+ */
 static int unix_show_sock(struct nlmsghdr *nlh, struct filter *f)
 {
 	struct unix_diag_msg *r = NLMSG_DATA(nlh);
 	struct rtattr *tb[UNIX_DIAG_MAX+1];
-	char name[128];
-	int peer_ino;
-	int rqlen;
+	struct unixstat *u;
 
 	parse_rtattr(tb, UNIX_DIAG_MAX, (struct rtattr*)(r+1),
 		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
 
-	if (netid_width)
-		printf("%-*s ", netid_width,
-				r->udiag_type == SOCK_STREAM ? "u_str" : "u_dgr");
-	if (state_width)
-		printf("%-*s ", state_width, sstate_name[r->udiag_state]);
-
-	if (tb[UNIX_DIAG_RQLEN])
-		rqlen = *(int *)RTA_DATA(tb[UNIX_DIAG_RQLEN]);
-	else
-		rqlen = 0;
-
-	printf("%-6d %-6d ", rqlen, 0);
+	u = unix_arena_alloc(sizeof(*u));
+	if (u == NULL) {
+		perror("Cannot allocate unix socket");
+		return -1;
+	}
+	memset(u, 0, sizeof(*u));
+	u->ino = r->udiag_ino;
+	u->type = r->udiag_type;
+	u->state = r->udiag_state;
 
 	if (tb[UNIX_DIAG_NAME]) {
 		int len = RTA_PAYLOAD(tb[UNIX_DIAG_NAME]);
 
-		memcpy(name, RTA_DATA(tb[UNIX_DIAG_NAME]), len);
-		name[len] = '\0';
-		if (name[0] == '\0')
-			name[0] = '@';
-	} else
-		sprintf(name, "*");
+		if ((u->name = unix_arena_alloc(len + 1)) == NULL) {
+			perror("Cannot allocate unix socket");
+			return -1;
+		}
+		memcpy(u->name, RTA_DATA(tb[UNIX_DIAG_NAME]), len);
+		u->name[len] = '\0';
+		if (u->name[0] == '\0')
+			u->name[0] = '@';
+	}
 
 	if (tb[UNIX_DIAG_PEER])
-		peer_ino = *(int *)RTA_DATA(tb[UNIX_DIAG_PEER]);
-	else
-		peer_ino = 0;
+		u->peer = *(int *)RTA_DATA(tb[UNIX_DIAG_PEER]);
+	if (tb[UNIX_DIAG_RQLEN]) {
+		struct unix_diag_rqlen rql = { 0 };
+		int len = RTA_PAYLOAD(tb[UNIX_DIAG_RQLEN]);
 
-	printf("%*s %-*d %*s %-*d",
-			addr_width, name,
-			serv_width, r->udiag_ino,
-			addr_width, "*", /* FIXME */
-			serv_width, peer_ino);
-
-	if (show_users) {
-		char ubuf[4096];
-		if (find_users(r->udiag_ino, ubuf, sizeof(ubuf)) > 0)
-			printf(" users:(%s)", ubuf);
+		if (len > sizeof(rql))
+			len = sizeof(rql);
+		memcpy(&rql, RTA_DATA(tb[UNIX_DIAG_RQLEN]), len);
+		u->rq = rql.udiag_rqueue;
+		u->wq = rql.udiag_wqueue;
 	}
 
-	printf("\n");
-
+	if (unix_store(u) < 0) {
+		perror("Cannot allocate unix socket hash");
+		return -1;
+	}
+	if (u->peer && unix_lookup(u->peer) == NULL)
+		return unix_defer(u);
+	unix_print(u, f);
 	return 0;
 }
 
 static int unix_show_netlink(struct filter *f, FILE *dump_fp)
 {
-	int fd;
 	struct {
 		struct nlmsghdr nlh;
 		struct unix_diag_req r;
 	} req;
-	char	buf[8192];
+	struct diag_dump d;
+	unsigned i;
+	int err;
 
-	if ((fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG)) < 0)
+	if (diag_open() < 0)
 		return -1;
 
 	memset(&req, 0, sizeof(req));
 	req.nlh.nlmsg_len = sizeof(req);
 	req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
 	req.nlh.nlmsg_flags = NLM_F_ROOT|NLM_F_MATCH|NLM_F_REQUEST;
-	req.nlh.nlmsg_seq = 123456;
+	req.nlh.nlmsg_seq = diag_rth.dump = ++diag_rth.seq;
 
 	req.r.sdiag_family = AF_UNIX;
 	req.r.udiag_states = f->states;
 	req.r.udiag_show = UDIAG_SHOW_NAME | UDIAG_SHOW_PEER | UDIAG_SHOW_RQLEN;
 
-	if (send(fd, &req, sizeof(req), 0) < 0) {
-		close(fd);
+	if (send(diag_rth.fd, &req, sizeof(req), 0) < 0)
 		return -1;
-	}
-
-	while (1) {
-		ssize_t status;
-		struct nlmsghdr *h;
-		struct sockaddr_nl nladdr;
-		socklen_t slen = sizeof(nladdr);
-
-		status = recvfrom(fd, buf, sizeof(buf), 0,
-				  (struct sockaddr *) &nladdr, &slen);
-		if (status < 0) {
-			if (errno == EINTR)
-				continue;
-			perror("OVERRUN");
-			continue;
-		}
-		if (status == 0) {
-			fprintf(stderr, "EOF on netlink\n");
-			goto close_it;
-		}
-
-		if (dump_fp)
-			fwrite(buf, 1, NLMSG_ALIGN(status), dump_fp);
-
-		h = (struct nlmsghdr*)buf;
-		while (NLMSG_OK(h, status)) {
-			int err;
-
-			if (/*h->nlmsg_pid != rth->local.nl_pid ||*/
-			    h->nlmsg_seq != 123456)
-				goto skip_it;
 
-			if (h->nlmsg_type == NLMSG_DONE)
-				goto close_it;
-
-			if (h->nlmsg_type == NLMSG_ERROR) {
-				struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
-				if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
-					fprintf(stderr, "ERROR truncated\n");
-				} else {
-					errno = -err->error;
-					if (errno != ENOENT)
-						fprintf(stderr, "UDIAG answers %d\n", errno);
-				}
-				close(fd);
-				return -1;
-			}
-			if (!dump_fp) {
-				err = unix_show_sock(h, f);
-				if (err < 0) {
-					close(fd);
-					return err;
-				}
-			}
-
-skip_it:
-			h = NLMSG_NEXT(h, status);
-		}
-
-		if (status) {
-			fprintf(stderr, "!!!Remnant of size %zd\n", status);
-			exit(1);
-		}
+	memset(&d, 0, sizeof(d));
+	d.f = f;
+	d.dump_fp = dump_fp;
+	d.show = unix_show_sock;
+	d.by_family = 1;
+	d.user_f = f;
+	err = diag_run(&d, "UDIAG answers");
+	if (err == 0) {
+		for (i = 0; i < unix_later_len; i++)
+			unix_print(unix_later[i], f);
 	}
-
-close_it:
-	close(fd);
-	return 0;
+	unix_store_free();
+	return err;
 }
 
 int unix_show(struct filter *f)
@@ -2177,8 +2871,7 @@ int unix_show(struct filter *f)
 	char buf[256];
 	char name[128];
 	int  newformat = 0;
-	int  cnt;
-	struct unixstat *list = NULL;
+	unsigned i;
 
 	if (!getenv("PROC_NET_UNIX") && !getenv("PROC_ROOT")
 	    && unix_show_netlink(f, NULL) == 0)
@@ -2190,13 +2883,12 @@ int unix_show(struct filter *f)
 
 	if (memcmp(buf, "Peer", 4) == 0)
 		newformat = 1;
-	cnt = 0;
 
 	while (fgets(buf, sizeof(buf)-1, fp)) {
-		struct unixstat *u, **insp;
+		struct unixstat *u;
 		int flags;
 
-		if (!(u = malloc(sizeof(*u))))
+		if (!(u = unix_arena_alloc(sizeof(*u))))
 			break;
 		u->name = NULL;
 
@@ -2221,36 +2913,21 @@ int unix_show(struct filter *f)
 			u->wq = 0;
 		}
 
-		insp = &list;
-		while (*insp) {
-			if (u->type < (*insp)->type ||
-			    (u->type == (*insp)->type &&
-			     u->ino < (*insp)->ino))
-				break;
-			insp = &(*insp)->next;
-		}
-		u->next = *insp;
-		*insp = u;
-
 		if (name[0]) {
-			if ((u->name = malloc(strlen(name)+1)) == NULL)
+			if ((u->name = unix_arena_alloc(strlen(name)+1)) == NULL)
 				break;
 			strcpy(u->name, name);
 		}
-		if (++cnt > MAX_UNIX_REMEMBER) {
-			unix_list_print(list, f);
-			unix_list_free(list);
-			list = NULL;
-			cnt = 0;
-		}
+		if (unix_store(u) < 0 || unix_defer(u) < 0)
+			break;
 	}
 	fclose(fp);
-	if (list) {
-		unix_list_print(list, f);
-		unix_list_free(list);
-		list = NULL;
-		cnt = 0;
-	}
+
+	/* /proc lists the sockets by type, then by inode */
+	qsort(unix_later, unix_later_len, sizeof(*unix_later), unix_cmp);
+	for (i = 0; i < unix_later_len; i++)
+		unix_print(unix_later[i], f);
+	unix_store_free();
 
 	return 0;
 }
@@ -2612,6 +3289,9 @@ static void _usage(FILE *dest)
 "\n"
 "   -D, --diag=FILE     Dump raw information about TCP sockets to FILE\n"
 "   -F, --filter=FILE   read filter information from FILE\n"
+"   -S, --dump-stats    report sockets per second of netlink dumps\n"
+"   -I, --interval=SECS sample TCP sockets every SECS and show the changes\n"
+"   -c, --count=N       stop after N samples\n"
 "       FILTER := [ state TCP-STATE ] [ EXPRESSION ]\n"
 		);
 }
@@ -2682,6 +3362,9 @@ static const struct option long_opts[] = {
 	{ "summary", 0, 0, 's' },
 	{ "diag", 1, 0, 'D' },
 	{ "filter", 1, 0, 'F' },
+	{ "dump-stats", 0, 0, 'S' },
+	{ "interval", 1, 0, 'I' },
+	{ "count", 1, 0, 'c' },
 	{ "version", 0, 0, 'V' },
 	{ "help", 0, 0, 'h' },
 	{ 0 }
@@ -2702,7 +3385,7 @@ int main(int argc, char *argv[])
 
 	current_filter.states = default_filter.states;
 
-	while ((ch = getopt_long(argc, argv, "dhaletuwxnro460spf:miA:D:F:vV",
+	while ((ch = getopt_long(argc, argv, "dhaletuwxnro460spf:miA:D:F:SI:c:vV",
 				 long_opts, NULL)) != EOF) {
 		switch(ch) {
 		case 'n':
@@ -2726,7 +3409,6 @@ int main(int argc, char *argv[])
 			break;
 		case 'p':
 			show_users++;
-			user_ent_hash_build();
 			break;
 		case 'd':
 			current_filter.dbs |= (1<<DCCP_DB);
@@ -2837,6 +3519,26 @@ int main(int argc, char *argv[])
 		case 'D':
 			dump_tcpdiag = optarg;
 			break;
+		case 'S':
+			dump_stats = 1;
+			break;
+		case 'I':
+		{
+			char *end;
+
+			sample_interval = strtod(optarg, &end);
+			if (*end || sample_interval <= 0) {
+				fprintf(stderr, "ss: invalid interval \"%s\"\n", optarg);
+				exit(-1);
+			}
+			break;
+		}
+		case 'c':
+			if (get_unsigned(&sample_rounds, optarg, 0)) {
+				fprintf(stderr, "ss: invalid count \"%s\"\n", optarg);
+				exit(-1);
+			}
+			break;
 		case 'F':
 			if (filter_fp) {
 				fprintf(stderr, "More than one filter file\n");
@@ -2976,6 +3678,22 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
+	if (sample_interval) {
+		current_filter.dbs &= (1<<TCP_DB);
+		if (current_filter.dbs == 0) {
+			fprintf(stderr, "ss: sampling shows only TCP sockets.\n");
+			exit(0);
+		}
+	}
+
+	/* Large dumps into a pipe or file go out in big writes */
+	if (!isatty(STDOUT_FILENO)) {
+		char *outbuf = malloc(1024 * 1024);
+
+		if (outbuf)
+			setvbuf(stdout, outbuf, _IOFBF, 1024 * 1024);
+	}
+
 	netid_width = 0;
 	if (current_filter.dbs&(current_filter.dbs-1))
 		netid_width = 5;
@@ -3028,6 +3746,9 @@ int main(int argc, char *argv[])
 
 	fflush(stdout);
 
+	if (sample_interval)
+		return tcp_sample(&current_filter) < 0 ? -1 : 0;
+
 	if (current_filter.dbs & (1<<NETLINK_DB))
 		netlink_show(&current_filter);
 	if (current_filter.dbs & PACKET_DBM)
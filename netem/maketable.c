@@ -12,39 +12,124 @@
 #include <math.h>
 #include <malloc.h>
 #include <string.h>
+#include <ctype.h>
+#include <unistd.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 
 
-double *
-readdoubles(FILE *fp, int *number)
+/* Values are read a block at a time, either as text or, with -b, as
+ * native doubles.  Parsing is most of the work for large inputs, so
+ * this avoids going through fscanf for every value.
+ */
+#define READBUF		65536
+#define MAXTOKEN	64
+
+struct reader {
+	FILE	*fp;
+	int	binary;
+	int	eof;
+	char	*p;
+	char	*end;
+	char	buf[READBUF + 1];
+};
+
+static void
+fillbuf(struct reader *r)
 {
-	struct stat info;
-	double *x;
-	int limit;
-	int n=0, i;
+	size_t left = r->end - r->p, n;
 
-	fstat(fileno(fp), &info);
-	if (info.st_size > 0) {
-		limit = 2*info.st_size/sizeof(double);	/* @@ approximate */
-	} else {
-		limit = 10000;
-	}
+	memmove(r->buf, r->p, left);
+	r->p = r->buf;
+	r->end = r->buf + left;
+	n = fread(r->end, 1, READBUF - left, r->fp);
+	if (n == 0)
+		r->eof = 1;
+	r->end += n;
+	*r->end = '\0';
+}
 
-	x = calloc(limit, sizeof(double));
-	if (!x) {
-		perror("double alloc");
-		exit(3);
+static int
+readvalue(struct reader *r, double *x)
+{
+	char *e;
+
+	if (r->binary) {
+		while (r->end - r->p < (int)sizeof(double) && !r->eof)
+			fillbuf(r);
+		if (r->end - r->p < (int)sizeof(double)) {
+			if (r->p != r->end)
+				fprintf(stderr, "Ignoring %d trailing bytes\n",
+					(int)(r->end - r->p));
+			return 0;
+		}
+		memcpy(x, r->p, sizeof(double));
+		r->p += sizeof(double);
+		return 1;
 	}
 
-	for (i=0; i<limit; ++i){
-		fscanf(fp, "%lf", &x[i]);
-		if (feof(fp))
+	for (;;) {
+		while (r->p < r->end && isspace((unsigned char)*r->p))
+			++r->p;
+		if (r->end - r->p >= MAXTOKEN || r->eof)
 			break;
-		++n;
+		fillbuf(r);
+	}
+	if (r->p == r->end)
+		return 0;
+
+	*x = strtod(r->p, &e);
+	if (e == r->p) {
+		fprintf(stderr, "Bad value \"%.20s\"\n", r->p);
+		exit(2);
+	}
+	r->p = e;
+	return 1;
+}
+
+/* Mean, deviation and lag-1 autocorrelation in one pass.  The sums are
+ * kept relative to the first value, which keeps them small.
+ */
+struct stats {
+	long long	n;
+	double		shift;
+	double		prev;
+	double		sum;
+	double		sumsquare;
+	double		lag;
+	double		lagsum;
+	double		prevsum;
+	double		prevsquare;
+};
+
+static void
+addstat(struct stats *s, double x)
+{
+	double y;
+
+	if (s->n == 0)
+		s->shift = x;
+	y = x - s->shift;
+	if (s->n > 0) {
+		s->lag += y*s->prev;
+		s->lagsum += y;
+		s->prevsum += s->prev;
+		s->prevsquare += s->prev*s->prev;
 	}
-	*number = n;
-	return x;
+	s->sum += y;
+	s->sumsquare += y*y;
+	s->prev = y;
+	++s->n;
+}
+
+static void
+getstats(const struct stats *s, double *mu, double *sigma, double *rho)
+{
+	double n = (double)s->n, m = s->sum/n;
+
+	*mu = s->shift + m;
+	*sigma = sqrt((s->sumsquare - n*m*m)/(n-1));
+	*rho = (s->lag - m*(s->lagsum + s->prevsum) + (n-1)*m*m) /
+		(s->prevsquare - 2*m*s->prevsum + (n-1)*m*m);
 }
 
 void
@@ -89,14 +174,23 @@ arraystats(double *x, int limit, double *mu, double *sigma, double *rho)
 #define DISTTABLEGRANULARITY 50000
 #define DISTTABLESIZE (DISTTABLEDOMAIN*DISTTABLEGRANULARITY*2)
 
-static int *
+static int
+distindex(double input)
+{
+	int index = (int)rint((input+DISTTABLEDOMAIN)*DISTTABLEGRANULARITY);
+
+	if (index < 0) index = 0;
+	if (index >= DISTTABLESIZE) index = DISTTABLESIZE-1;
+	return index;
+}
+
+static long long *
 makedist(double *x, int limit, double mu, double sigma)
 {
-	int *table;
-	int i, index, first=DISTTABLESIZE, last=0;
-	double input;
+	long long *table;
+	int i;
 
-	table = calloc(DISTTABLESIZE, sizeof(int));
+	table = calloc(DISTTABLESIZE, sizeof(*table));
 	if (!table) {
 		perror("table alloc");
 		exit(3);
@@ -104,25 +198,121 @@ makedist(double *x, int limit, double mu, double sigma)
 
 	for (i=0; i < limit; ++i) {
 		/* Normalize value */
-		input = (x[i]-mu)/sigma;
+		++table[distindex((x[i]-mu)/sigma)];
+	}
+	return table;
+}
+
+/* Inputs too large to keep go into a histogram of the raw values.  Its
+ * range starts at HISTRANGE deviations around the mean of the first
+ * WARMUP values and doubles when a value falls outside, merging pairs
+ * of buckets, but not past HISTLIMIT deviations of the mean so far.
+ * Anything further out only counts as below or above; the table stops
+ * at DISTTABLEDOMAIN deviations anyway.
+ */
+#define WARMUP		(1 << 20)
+#define HISTBINS	(1 << 21)
+#define HISTRANGE	32
+#define HISTLIMIT	64
+
+struct hist {
+	double			lo;
+	double			width;
+	unsigned long long	below;
+	unsigned long long	above;
+	unsigned long long	*count;
+};
+
+static void
+histinit(struct hist *h, double mu, double sigma)
+{
+	double half = HISTRANGE * sigma;
+
+	if (!(half > 0))
+		half = fabs(mu) > 0 ? fabs(mu) : 1.0;
+	h->lo = mu - half;
+	h->width = 2*half/HISTBINS;
+	h->below = h->above = 0;
+	h->count = calloc(HISTBINS, sizeof(*h->count));
+	if (!h->count) {
+		perror("histogram alloc");
+		exit(3);
+	}
+}
+
+static void
+histgrow(struct hist *h, int down)
+{
+	int i;
+
+	if (down) {
+		for (i=HISTBINS-1; i >= HISTBINS/2; --i)
+			h->count[i] = h->count[2*i-HISTBINS] +
+				h->count[2*i-HISTBINS+1];
+		memset(h->count, 0, HISTBINS/2 * sizeof(*h->count));
+		h->lo -= h->width * HISTBINS;
+	} else {
+		for (i=0; i < HISTBINS/2; ++i)
+			h->count[i] = h->count[2*i] + h->count[2*i+1];
+		memset(h->count + HISTBINS/2, 0, HISTBINS/2 * sizeof(*h->count));
+	}
+	h->width *= 2;
+}
+
+static void
+histadd(struct hist *h, const struct stats *s, double x)
+{
+	double mu, sigma, rho, pos;
+
+	pos = (x - h->lo) / h->width;
+	if (pos < 0 || pos >= HISTBINS) {
+		getstats(s, &mu, &sigma, &rho);
+		while (x < h->lo && x > mu - HISTLIMIT*sigma)
+			histgrow(h, 1);
+		while (x >= h->lo + h->width*HISTBINS &&
+		       x < mu + HISTLIMIT*sigma)
+			histgrow(h, 0);
+		pos = (x - h->lo) / h->width;
+		if (pos < 0) {
+			++h->below;
+			return;
+		}
+		if (pos >= HISTBINS) {
+			++h->above;
+			return;
+		}
+	}
+	++h->count[(int)pos];
+}
+
+/* makedist() for the histogram, taking each bucket at its middle */
+static long long *
+histdist(const struct hist *h, double mu, double sigma)
+{
+	long long *table;
+	int i;
+
+	table = calloc(DISTTABLESIZE, sizeof(*table));
+	if (!table) {
+		perror("table alloc");
+		exit(3);
+	}
 
-		index = (int)rint((input+DISTTABLEDOMAIN)*DISTTABLEGRANULARITY);
-		if (index < 0) index = 0;
-		if (index >= DISTTABLESIZE) index = DISTTABLESIZE-1;
-		++table[index];
-		if (index > last)
-			last = index +1;
-		if (index < first)
-			first = index;
+	table[0] += h->below;
+	table[DISTTABLESIZE-1] += h->above;
+	for (i=0; i < HISTBINS; ++i) {
+		if (h->count[i])
+			table[distindex((h->lo + (i+0.5)*h->width - mu)/sigma)]
+				+= h->count[i];
 	}
 	return table;
 }
 
 /* replace an array by its cumulative distribution */
 static void
-cumulativedist(int *table, int limit, int *total)
+cumulativedist(long long *table, int limit, long long *total)
 {
-	int accum=0;
+	long long accum=0;
 
 	while (--limit >= 0) {
 		accum += *table;
@@ -132,7 +322,7 @@ cumulativedist(int *table, int limit, int *total)
 }
 
 static short *
-inverttable(int *table, int inversesize, int tablesize, int cumulative)
+inverttable(long long *table, int inversesize, int tablesize, long long cumulative)
 {
 	int i, inverseindex, inversevalue;
 	short *inverse;
@@ -192,38 +382,91 @@ printtable(const short *table, int limit)
 	}
 }
 
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: maketable [ -b ] [ FILE ]\n");
+	fprintf(stderr, "  -b  FILE holds native doubles instead of text\n");
+	exit(1);
+}
+
 int
 main(int argc, char **argv)
 {
-	FILE *fp;
+	struct reader *r;
+	struct stats st;
+	struct hist h;
 	double *x;
 	double mu, sigma, rho;
-	int limit;
-	int *table;
+	int limit, c, binary = 0;
+	long long *table;
 	short *inverse;
-	int total;
+	long long total;
+	FILE *fp;
+
+	while ((c = getopt(argc, argv, "b")) != -1) {
+		if (c == 'b')
+			binary = 1;
+		else
+			usage();
+	}
+	if (optind < argc - 1)
+		usage();
 
-	if (argc > 1) {
-		if (!(fp = fopen(argv[1], "r"))) {
-			perror(argv[1]);
+	if (optind < argc) {
+		if (!(fp = fopen(argv[optind], "r"))) {
+			perror(argv[optind]);
 			exit(1);
 		}
 	} else {
 		fp = stdin;
-	}				
-	x = readdoubles(fp, &limit);
+	}
+
+	r = calloc(1, sizeof(*r));
+	x = malloc(WARMUP * sizeof(double));
+	if (!r || !x) {
+		perror("buffer alloc");
+		exit(3);
+	}
+	r->fp = fp;
+	r->binary = binary;
+	r->p = r->end = r->buf;
+
+	memset(&st, 0, sizeof(st));
+	for (limit=0; limit < WARMUP && readvalue(r, &x[limit]); ++limit)
+		addstat(&st, x[limit]);
 	if (limit <= 0) {
 		fprintf(stderr, "Nothing much read!\n");
 		exit(2);
 	}
-	arraystats(x, limit, &mu, &sigma, &rho);
+
+	if (limit < WARMUP) {
+		/* Small enough to work on the values themselves */
+		arraystats(x, limit, &mu, &sigma, &rho);
+		table = makedist(x, limit, mu, sigma);
+	} else {
+		double v;
+		int i;
+
+		getstats(&st, &mu, &sigma, &rho);
+		histinit(&h, mu, sigma);
+		for (i=0; i < limit; ++i)
+			histadd(&h, &st, x[i]);
+		while (readvalue(r, &v)) {
+			addstat(&st, v);
+			histadd(&h, &st, v);
+		}
+		getstats(&st, &mu, &sigma, &rho);
+		table = histdist(&h, mu, sigma);
+		free(h.count);
+	}
+	free(x);
+	free(r);
 #ifdef DEBUG
-	fprintf(stderr, "%d values, mu %10.4f, sigma %10.4f, rho %10.4f\n",
-		limit, mu, sigma, rho);
+	fprintf(stderr, "%lld values, mu %10.4f, sigma %10.4f, rho %10.4f\n",
+		st.n, mu, sigma, rho);
 #endif
-	
-	table = makedist(x, limit, mu, sigma);
-	free((void *) x);
+
 	cumulativedist(table, DISTTABLESIZE, &total);
 	inverse = inverttable(table, TABLESIZE, DISTTABLESIZE, total);
 	interpolatetable(inverse, TABLESIZE);
@@ -20,11 +20,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <errno.h>
 #include <linux/if.h>
 #include <linux/if_ether.h>
 
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_common.h"
 
 extern int show_pretty;
 
@@ -37,11 +39,13 @@ static void explain(void)
 	fprintf(stderr, "               [ ht HTID ] [ hashkey HASHKEY_SPEC ]\n");
 	fprintf(stderr, "               [ sample SAMPLE ]\n");
 	fprintf(stderr, "or         u32 divisor DIVISOR\n");
+	fprintf(stderr, "or         u32 rules FILE\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Where: SELECTOR := SAMPLE SAMPLE ...\n");
 	fprintf(stderr, "       SAMPLE := { ip | ip6 | udp | tcp | icmp |"
 		" u{32|16|8} | mark } SAMPLE_ARGS [divisor DIVISOR]\n");
 	fprintf(stderr, "       FILTERID := X:Y:Z\n");
+	fprintf(stderr, "       FILE holds lines of \"match SELECTOR ... classid CLASSID\"\n");
 	fprintf(stderr, "\nNOTE: CLASSID is parsed at hexadecimal input.\n");
 }
 
@@ -972,6 +976,506 @@ show_k:
 	goto show_k;
 }
 
+/* "u32 rules FILE" takes a list of rules, one per line,
+ *
+ *	match SELECTOR [ match SELECTOR ... ] { classid | flowid } CLASSID
+ *
+ * and builds a tree of hash tables for them instead of one long list.
+ * Each table hashes on one byte of the packet that most rules match in
+ * full, picked so that the fullest bucket is as small as possible;
+ * buckets that still hold too many rules get a table of their own,
+ * keyed on another byte.  A rule that does not pin down the byte goes
+ * into every bucket it can match, so the first match in file order
+ * still wins.  Hashing on a single byte gives the same bucket with the
+ * old and the new kernel hash fold.
+ *
+ * The tables are filled bottom up and the link from the root table is
+ * the last request, so traffic never sees a half built tree.  The
+ * handle of the command, if any, is the first table id to use.
+ */
+#define U32_LIST	8	/* rules a bucket may keep in a list */
+#define U32_LEVELS	4
+#define U32_MAXHTID	0x7ff	/* ids from 0x800 on are the kernel's */
+
+struct u32_rule
+{
+	int			lineno;
+	__u32			classid;
+	struct tc_u32_sel	*sel;
+};
+
+struct u32_node
+{
+	int			nrules;
+	int			*rules;		/* in file order */
+	__u32			htid;		/* 0 if a plain list */
+	int			off;		/* of the word hashed on */
+	int			byte;		/* in it, 0 is the first */
+	int			divisor;
+	struct u32_node		*child;
+};
+
+static struct u32_rule *u32_rules;
+static int u32_nrules;
+static __u32 u32_next_htid;
+static struct {
+	int	tables;
+	int	filters;
+	int	longest;
+} u32_stats;
+
+static int u32_read_rules(const char *name)
+{
+	int saved_lineno = cmdlineno;
+	char *line = NULL;
+	size_t len = 0;
+	int max = 0, ret = 0;
+	FILE *fp;
+
+	fp = fopen(name, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot open rules \"%s\": %s\n",
+			name, strerror(errno));
+		return -1;
+	}
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		struct {
+			struct tc_u32_sel sel;
+			struct tc_u32_key keys[128];
+		} sel;
+		struct u32_rule *r;
+		char *largv[100];
+		char **argv = largv;
+		int argc, size;
+
+		argc = makeargs(line, largv, 100);
+		if (argc == 0)
+			continue;
+
+		if (u32_nrules == max) {
+			int grow = max ? max * 2 : 1024;
+
+			r = realloc(u32_rules, grow * sizeof(*r));
+			if (r == NULL) {
+				perror("Cannot allocate rules");
+				ret = -1;
+				break;
+			}
+			u32_rules = r;
+			max = grow;
+		}
+		r = &u32_rules[u32_nrules];
+		memset(r, 0, sizeof(*r));
+		r->lineno = cmdlineno;
+		memset(&sel, 0, sizeof(sel));
+
+		while (argc > 0) {
+			if (matches(*argv, "match") == 0 && argc > 1 &&
+			    matches(argv[1], "mark") != 0) {
+				NEXT_ARG();
+				if (parse_selector(&argc, &argv, &sel.sel, NULL))
+					break;
+				continue;
+			} else if ((matches(*argv, "classid") == 0 ||
+				    strcmp(*argv, "flowid") == 0) && argc > 1) {
+				NEXT_ARG();
+				if (get_tc_classid(&r->classid, *argv))
+					break;
+			} else
+				break;
+			argc--; argv++;
+		}
+		if (argc > 0 || sel.sel.nkeys == 0 || r->classid == 0) {
+			fprintf(stderr, "Illegal rule at %s:%d%s%s\n", name,
+				cmdlineno, argc > 0 ? " near " : "",
+				argc > 0 ? *argv : "");
+			ret = -1;
+			break;
+		}
+
+		size = sizeof(sel.sel) + sel.sel.nkeys * sizeof(struct tc_u32_key);
+		r->sel = malloc(size);
+		if (r->sel == NULL) {
+			perror("Cannot allocate rules");
+			ret = -1;
+			break;
+		}
+		memcpy(r->sel, &sel, size);
+		r->sel->flags |= TC_U32_TERMINAL;
+		u32_nrules++;
+	}
+	if (ret == 0 && u32_nrules == 0) {
+		fprintf(stderr, "No rules in \"%s\"\n", name);
+		ret = -1;
+	}
+
+	free(line);
+	fclose(fp);
+	cmdlineno = saved_lineno;
+	return ret;
+}
+
+/* What a rule wants of a byte of the packet: value and mask */
+static __u8 u32_rule_byte(const struct tc_u32_sel *sel, int off, int byte,
+			  __u8 *mask)
+{
+	__u8 val = 0;
+	int i;
+
+	*mask = 0;
+	for (i = 0; i < sel->nkeys; i++) {
+		const struct tc_u32_key *k = &sel->keys[i];
+
+		if (k->off != off || k->offmask)
+			continue;
+		val |= ((__u8 *)&k->val)[byte];
+		*mask |= ((__u8 *)&k->mask)[byte];
+	}
+	return val & *mask;
+}
+
+/* Returns the load of the fullest bucket; fills "load" if given. */
+static int u32_spread(const struct u32_node *nd, int off, int byte,
+		      int divisor, int *load)
+{
+	int i, b, max = 0;
+	int count[256];
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < nd->nrules; i++) {
+		const struct u32_rule *r = &u32_rules[nd->rules[i]];
+		__u8 mask, val = u32_rule_byte(r->sel, off, byte, &mask);
+
+		mask &= divisor - 1;
+		for (b = 0; b < divisor; b++) {
+			if ((b & mask) == (val & mask))
+				count[b]++;
+		}
+	}
+	for (b = 0; b < divisor; b++) {
+		if (count[b] > max)
+			max = count[b];
+		if (load)
+			load[b] = count[b];
+	}
+	return max;
+}
+
+static int u32_split(struct u32_node *nd, int level)
+{
+	struct {
+		int	off;
+		int	byte;
+		int	count;
+	} cand[64];
+	int ncand = 0, best = -1, bestmax = nd->nrules;
+	int load[256];
+	int i, j, b, divisor;
+
+	u32_stats.filters += nd->nrules;
+	if (nd->nrules <= U32_LIST || level >= U32_LEVELS ||
+	    u32_next_htid > U32_MAXHTID)
+		goto list;
+
+	/* Bytes matched in full, and by how many rules */
+	for (i = 0; i < nd->nrules; i++) {
+		const struct tc_u32_sel *sel = u32_rules[nd->rules[i]].sel;
+
+		for (j = 0; j < sel->nkeys; j++) {
+			const struct tc_u32_key *k = &sel->keys[j];
+
+			if (k->offmask)
+				continue;
+			for (b = 0; b < 4; b++) {
+				int c;
+
+				if (((__u8 *)&k->mask)[b] != 0xff)
+					continue;
+				for (c = 0; c < ncand; c++) {
+					if (cand[c].off == k->off &&
+					    cand[c].byte == b)
+						break;
+				}
+				if (c == ncand) {
+					if (ncand == 64)
+						continue;
+					cand[c].off = k->off;
+					cand[c].byte = b;
+					cand[c].count = 0;
+					ncand++;
+				}
+				cand[c].count++;
+			}
+		}
+	}
+
+	divisor = 2;
+	while (divisor < 256 && divisor * U32_LIST < nd->nrules)
+		divisor *= 2;
+
+	for (i = 0; i < ncand; i++) {
+		int max;
+
+		if (cand[i].count * 2 < nd->nrules)
+			continue;
+		max = u32_spread(nd, cand[i].off, cand[i].byte, divisor, NULL);
+		if (max < bestmax) {
+			bestmax = max;
+			best = i;
+		}
+	}
+	if (best < 0)
+		goto list;
+
+	nd->off = cand[best].off;
+	nd->byte = cand[best].byte;
+	nd->divisor = divisor;
+	nd->htid = u32_next_htid++ << 20;
+	nd->child = calloc(divisor, sizeof(struct u32_node));
+	if (nd->child == NULL) {
+		perror("Cannot allocate hash table");
+		return -1;
+	}
+	u32_spread(nd, nd->off, nd->byte, divisor, load);
+	for (b = 0; b < divisor; b++) {
+		nd->child[b].rules = malloc((load[b] + 1) * sizeof(int));
+		if (nd->child[b].rules == NULL) {
+			perror("Cannot allocate hash table");
+			return -1;
+		}
+	}
+	for (i = 0; i < nd->nrules; i++) {
+		const struct u32_rule *r = &u32_rules[nd->rules[i]];
+		__u8 mask, val = u32_rule_byte(r->sel, nd->off, nd->byte, &mask);
+
+		mask &= divisor - 1;
+		for (b = 0; b < divisor; b++) {
+			struct u32_node *c = &nd->child[b];
+
+			if ((b & mask) == (val & mask))
+				c->rules[c->nrules++] = nd->rules[i];
+		}
+	}
+
+	u32_stats.filters -= nd->nrules;
+	u32_stats.tables++;
+	for (b = 0; b < divisor; b++) {
+		if (nd->child[b].nrules == 0)
+			continue;
+		if (u32_split(&nd->child[b], level + 1) < 0)
+			return -1;
+		if (nd->child[b].htid)
+			u32_stats.filters++;	/* the link */
+	}
+	return 0;
+
+list:
+	if (nd->nrules > u32_stats.longest)
+		u32_stats.longest = nd->nrules;
+	return 0;
+}
+
+static void u32_add_rule(struct nlmsghdr *n, __u32 ht, __u32 classid,
+			 const struct tc_u32_sel *sel, __u32 link)
+{
+	struct rtattr *tail = NLMSG_TAIL(n);
+
+	addattr_l(n, MAX_MSG, TCA_OPTIONS, NULL, 0);
+	if (ht)
+		addattr_l(n, MAX_MSG, TCA_U32_HASH, &ht, 4);
+	if (link)
+		addattr_l(n, MAX_MSG, TCA_U32_LINK, &link, 4);
+	else
+		addattr_l(n, MAX_MSG, TCA_U32_CLASSID, &classid, 4);
+	addattr_l(n, MAX_MSG, TCA_U32_SEL, sel,
+		  sizeof(*sel) + sel->nkeys * sizeof(struct tc_u32_key));
+	tail->rta_len = (void *) NLMSG_TAIL(n) - (void *) tail;
+}
+
+/* The link from bucket "ht" to the table of "nd" */
+static void u32_add_link(struct nlmsghdr *n, __u32 ht,
+			 const struct u32_node *nd)
+{
+	struct {
+		struct tc_u32_sel sel;
+		struct tc_u32_key keys[1];
+	} sel;
+
+	memset(&sel, 0, sizeof(sel));
+	sel.sel.nkeys = 1;		/* match u32 0 0 */
+	sel.sel.hoff = nd->off;
+	sel.sel.hmask = htonl(0xff << (24 - 8 * nd->byte));
+	u32_add_rule(n, ht, 0, &sel.sel, nd->htid);
+}
+
+/* Requests go out with the header of the command being parsed */
+static void u32_start(struct nlmsghdr *n, struct nlmsghdr *req)
+{
+	memcpy(req, n, n->nlmsg_len);
+	((struct tcmsg *)NLMSG_DATA(req))->tcm_handle = 0;
+}
+
+static int u32_talk(struct nlmsghdr *req, int lineno)
+{
+	if (rtnl_talk(&rth, req, 0, 0, NULL) < 0) {
+		if (lineno)
+			fprintf(stderr, "Cannot add the rule at line %d\n",
+				lineno);
+		else
+			fprintf(stderr, "Cannot add u32 hash tables\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int u32_build(struct nlmsghdr *n, const struct u32_node *nd)
+{
+	struct {
+		struct nlmsghdr n;
+		char		buf[MAX_MSG];
+	} req;
+	struct rtattr *tail;
+	int b, i;
+
+	u32_start(n, &req.n);
+	((struct tcmsg *)NLMSG_DATA(&req.n))->tcm_handle = nd->htid;
+	tail = NLMSG_TAIL(&req.n);
+	addattr_l(&req.n, MAX_MSG, TCA_OPTIONS, NULL, 0);
+	addattr_l(&req.n, MAX_MSG, TCA_U32_DIVISOR, &nd->divisor, 4);
+	tail->rta_len = (void *) NLMSG_TAIL(&req.n) - (void *) tail;
+	if (u32_talk(&req.n, 0) < 0)
+		return -1;
+
+	for (b = 0; b < nd->divisor; b++) {
+		const struct u32_node *c = &nd->child[b];
+		__u32 ht = nd->htid | (b << 12);
+
+		if (c->htid) {
+			if (u32_build(n, c) < 0)
+				return -1;
+			u32_start(n, &req.n);
+			u32_add_link(&req.n, ht, c);
+			if (u32_talk(&req.n, 0) < 0)
+				return -1;
+			continue;
+		}
+		for (i = 0; i < c->nrules; i++) {
+			const struct u32_rule *r = &u32_rules[c->rules[i]];
+
+			u32_start(n, &req.n);
+			u32_add_rule(&req.n, ht, r->classid, r->sel, 0);
+			if (u32_talk(&req.n, r->lineno) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int u32_tree(struct nlmsghdr *n, struct u32_node *root)
+{
+	struct u32_rule *r;
+	int i;
+
+	root->nrules = u32_nrules;
+	root->rules = malloc(u32_nrules * sizeof(int));
+	if (root->rules == NULL) {
+		perror("Cannot allocate rules");
+		return -1;
+	}
+	for (i = 0; i < u32_nrules; i++)
+		root->rules[i] = i;
+	if (u32_split(root, 0) < 0)
+		return -1;
+
+	if (show_stats)
+		fprintf(stderr, "u32: %d rules, %d hash tables, %d filters, "
+			"up to %d rules in a list\n", u32_nrules,
+			u32_stats.tables, u32_stats.filters, u32_stats.longest);
+
+	/* The command itself adds the last rule, or the link to the tree */
+	if (root->htid) {
+		if (u32_build(n, root) < 0)
+			return -1;
+		u32_add_link(n, 0, root);
+		return 0;
+	}
+	for (i = 0; i < u32_nrules - 1; i++) {
+		struct {
+			struct nlmsghdr n;
+			char		buf[MAX_MSG];
+		} req;
+
+		r = &u32_rules[i];
+		u32_start(n, &req.n);
+		u32_add_rule(&req.n, 0, r->classid, r->sel, 0);
+		if (u32_talk(&req.n, r->lineno) < 0)
+			return -1;
+	}
+	r = &u32_rules[u32_nrules - 1];
+	u32_add_rule(n, 0, r->classid, r->sel, 0);
+	return 0;
+}
+
+static void u32_free(struct u32_node *nd)
+{
+	int b;
+
+	for (b = 0; nd->child && b < nd->divisor; b++)
+		u32_free(&nd->child[b]);
+	free(nd->child);
+	free(nd->rules);
+}
+
+/* A batch may have several of these */
+static void u32_free_rules(struct u32_node *root)
+{
+	int i;
+
+	u32_free(root);
+	for (i = 0; i < u32_nrules; i++)
+		free(u32_rules[i].sel);
+	free(u32_rules);
+	u32_rules = NULL;
+	u32_nrules = 0;
+}
+
+static int u32_parse_rules(char *handle, int argc, char **argv,
+			   struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct u32_node root;
+	int ret;
+
+	if (argc != 2) {
+		fprintf(stderr, "\"rules\" takes a file and nothing else\n");
+		return -1;
+	}
+	if (TC_H_MAJ(t->tcm_info) == 0) {
+		fprintf(stderr, "\"rules\" need a priority\n");
+		return -1;
+	}
+	u32_next_htid = 1;
+	if (handle) {
+		if (TC_U32_NODE(t->tcm_handle) || TC_U32_HASH(t->tcm_handle) ||
+		    TC_U32_USERHTID(t->tcm_handle) == 0) {
+			fprintf(stderr, "With \"rules\", the handle is the first hash table to use\n");
+			return -1;
+		}
+		u32_next_htid = TC_U32_USERHTID(t->tcm_handle);
+	}
+	t->tcm_handle = 0;
+
+	memset(&root, 0, sizeof(root));
+	memset(&u32_stats, 0, sizeof(u32_stats));
+	ret = u32_read_rules(argv[1]);
+	if (ret == 0)
+		ret = u32_tree(n, &root);
+	u32_free_rules(&root);
+	return ret;
+}
+
 static int u32_parse_opt(struct filter_util *qu, char *handle,
 			 int argc, char **argv, struct nlmsghdr *n)
 {
@@ -996,6 +1500,9 @@ static int u32_parse_opt(struct filter_util *qu, char *handle,
 	if (argc == 0)
 		return 0;
 
+	if (strcmp(*argv, "rules") == 0)
+		return u32_parse_rules(handle, argc, argv, n);
+
 	tail = NLMSG_TAIL(n);
 	addattr_l(n, MAX_MSG, TCA_OPTIONS, NULL, 0);
 
@@ -32,6 +32,14 @@ static struct action_util * action_list;
 
 #ifdef ANDROID
 extern struct action_util mirred_action_util;
+#else
+#define ACTION_KIND(id)	extern struct action_util id##_action_util;
+#include "tc_kinds.h"
+
+static const struct builtin_kind builtin_actions[] = {
+#define ACTION_KIND(id)	{ #id, &id##_action_util },
+#include "tc_kinds.h"
+};
 #endif
 
 #ifdef CONFIG_GACT
@@ -106,6 +114,12 @@ struct action_util *get_action_kind(char *str)
 	int looked4gact = 0;
 restart_s:
 #endif
+#ifndef ANDROID
+	a = find_builtin_kind(builtin_actions, ARRAY_SIZE(builtin_actions), str);
+	if (a)
+		return a;
+#endif
+
 	for (a = action_list; a; a = a->next) {
 		if (strcmp(a->id, str) == 0)
 			return a;
@@ -30,6 +30,14 @@
 
 static struct ematch_util *ematch_list;
 
+#define EMATCH_KIND(id)	extern struct ematch_util id##_ematch_util;
+#include "tc_kinds.h"
+
+static const struct builtin_kind builtin_ematches[] = {
+#define EMATCH_KIND(id)	{ #id, &id##_ematch_util },
+#include "tc_kinds.h"
+};
+
 /* export to bison parser */
 int ematch_argc;
 char **ematch_argv;
@@ -133,6 +141,11 @@ static struct ematch_util *get_ematch_kind(char *kind)
 	char buf[256];
 	struct ematch_util *e;
 
+	e = find_builtin_kind(builtin_ematches, ARRAY_SIZE(builtin_ematches),
+			      kind);
+	if (e)
+		return e;
+
 	for (e = ematch_list; e; e = e->next) {
 		if (strcmp(e->kind, kind) == 0)
 			return e;
@@ -19,6 +19,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <sys/utsname.h>
 
 #include "utils.h"
 #include "tc_util.h"
@@ -98,6 +99,25 @@ static int htb_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 	return 0;
 }
 
+/* Since 3.11 the kernel works the rates out itself and looks at the
+ * tables only to guess the link layer, which the ratespec now carries.
+ * Without them a class message is 2K smaller.
+ */
+static int htb_need_tables(void)
+{
+	static int need = -1;
+	struct utsname u;
+	int major, minor;
+
+	if (need < 0) {
+		need = 1;
+		if (getenv("TC_HTB_RTAB") == NULL && uname(&u) == 0 &&
+		    sscanf(u.release, "%d.%d", &major, &minor) == 2)
+			need = major < 3 || (major == 3 && minor < 11);
+	}
+	return need;
+}
+
 static int htb_parse_class_opt(struct qdisc_util *qu, int argc, char **argv, struct nlmsghdr *n)
 {
 	int ok=0;
@@ -232,8 +252,10 @@ static int htb_parse_class_opt(struct qdisc_util *qu, int argc, char **argv, str
 	tail = NLMSG_TAIL(n);
 	addattr_l(n, 1024, TCA_OPTIONS, NULL, 0);
 	addattr_l(n, 2024, TCA_HTB_PARMS, &opt, sizeof(opt));
-	addattr_l(n, 3024, TCA_HTB_RTAB, rtab, 1024);
-	addattr_l(n, 4024, TCA_HTB_CTAB, ctab, 1024);
+	if (htb_need_tables()) {
+		addattr_l(n, 3024, TCA_HTB_RTAB, rtab, 1024);
+		addattr_l(n, 4024, TCA_HTB_CTAB, ctab, 1024);
+	}
 	tail->rta_len = (void *) NLMSG_TAIL(n) - (void *) tail;
 	return 0;
 }
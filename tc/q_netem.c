@@ -26,6 +26,7 @@
 #include "utils.h"
 #include "tc_util.h"
 #include "tc_common.h"
+#include "tc_dist.h"
 
 static void explain(void)
 {
@@ -97,54 +98,6 @@ char * sprint_percent(__u32 per, char *buf)
 	return buf;
 }
 
-/*
- * Simplistic file parser for distrbution data.
- * Format is:
- *	# comment line(s)
- *	data0 data1 ...
- */
-static int get_distribution(const char *type, __s16 *data, int maxdata)
-{
-	FILE *f;
-	int n;
-	long x;
-	size_t len;
-	char *line = NULL;
-	char name[128];
-
-	snprintf(name, sizeof(name), "%s/%s.dist", get_tc_lib(), type);
-	if ((f = fopen(name, "r")) == NULL) {
-		fprintf(stderr, "No distribution data for %s (%s: %s)\n",
-			type, name, strerror(errno));
-		return -1;
-	}
-
-	n = 0;
-	while (getline(&line, &len, f) != -1) {
-		char *p, *endp;
-		if (*line == '\n' || *line == '#')
-			continue;
-
-		for (p = line; ; p = endp) {
-			x = strtol(p, &endp, 0);
-			if (endp == p)
-				break;
-
-			if (n >= maxdata) {
-				fprintf(stderr, "%s: too much data\n",
-					name);
-				n = -1;
-				goto error;
-			}
-			data[n++] = x;
-		}
-	}
- error:
-	free(line);
-	fclose(f);
-	return n;
-}
-
 #define NEXT_IS_NUMBER() (NEXT_ARG_OK() && isdigit(argv[1][0]))
 
 /* Adjust for the fact that psched_ticks aren't always usecs
@@ -177,7 +130,7 @@ static int netem_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 	struct tc_netem_gimodel gimodel;
 	struct tc_netem_gemodel gemodel;
 	struct tc_netem_rate rate;
-	__s16 *dist_data = NULL;
+	const __s16 *dist_data = NULL;
 	__u16 loss_type = NETEM_LOSS_UNSPEC;
 	int present[__TCA_NETEM_MAX];
 
@@ -377,12 +330,10 @@ static int netem_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 			}
 		} else if (matches(*argv, "distribution") == 0) {
 			NEXT_ARG();
-			dist_data = calloc(sizeof(dist_data[0]), MAX_DIST);
-			dist_size = get_distribution(*argv, dist_data, MAX_DIST);
-			if (dist_size <= 0) {
-				free(dist_data);
+			dist_data = tc_get_distribution(get_tc_lib(), *argv,
+							MAX_DIST, &dist_size);
+			if (dist_data == NULL)
 				return -1;
-			}
 		} else if (matches(*argv, "rate") == 0) {
 			++present[TCA_NETEM_RATE];
 			NEXT_ARG();
@@ -487,7 +438,6 @@ static int netem_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 			      TCA_NETEM_DELAY_DIST,
 			      dist_data, dist_size * sizeof(dist_data[0])) < 0)
 			return -1;
-		free(dist_data);
 	}
 	tail->rta_len = (void *) NLMSG_TAIL(n) - (void *) tail;
 	return 0;
@@ -27,6 +27,7 @@
 
 #include "SNAPSHOT.h"
 #include "utils.h"
+#include "ll_map.h"
 #include "tc_util.h"
 #include "tc_common.h"
 
@@ -38,6 +39,7 @@ int show_pretty = 0;
 int resolve_hosts = 0;
 int use_iec = 0;
 int force = 0;
+int batch_window = 1;
 struct rtnl_handle rth;
 
 static void *BODY = NULL;	/* cached handle dlopen(NULL) */
@@ -49,6 +51,21 @@ extern struct qdisc_util cbq_qdisc_util;
 extern struct qdisc_util htb_qdisc_util;
 extern struct qdisc_util ingress_qdisc_util;
 extern struct filter_util u32_filter_util;
+#else
+/* Kinds linked into tc are found without probing for q_*.so/f_*.so */
+#define QDISC_KIND(id)	extern struct qdisc_util id##_qdisc_util;
+#define FILTER_KIND(id)	extern struct filter_util id##_filter_util;
+#include "tc_kinds.h"
+
+static const struct builtin_kind builtin_qdiscs[] = {
+#define QDISC_KIND(id)	{ #id, &id##_qdisc_util },
+#include "tc_kinds.h"
+};
+
+static const struct builtin_kind builtin_filters[] = {
+#define FILTER_KIND(id)	{ #id, &id##_filter_util },
+#include "tc_kinds.h"
+};
 #endif
 
 static int print_noqopt(struct qdisc_util *qu, FILE *f,
@@ -115,7 +132,12 @@ struct qdisc_util *get_qdisc_kind(const char *str)
 		fprintf(stderr, "Android does not support qdisc '%s'\n", str);
 		return NULL;
 	}
+#else
+	q = find_builtin_kind(builtin_qdiscs, ARRAY_SIZE(builtin_qdiscs), str);
+	if (q)
+		return q;
 #endif
+
 	for (q = qdisc_list; q; q = q->next)
 		if (strcmp(q->id, str) == 0)
 			return q;
@@ -168,6 +190,10 @@ struct filter_util *get_filter_kind(const char *str)
 		fprintf(stderr, "Android does not support filter '%s'\n", str);
 		return NULL;
 	}
+#else
+	q = find_builtin_kind(builtin_filters, ARRAY_SIZE(builtin_filters), str);
+	if (q)
+		return q;
 #endif
 
 	for (q = filter_list; q; q = q->next)
@@ -212,7 +238,8 @@ static void usage(void)
 #ifdef ANDROID
 			"       tc [-force]\n"
 #else
-			"       tc [-force] -batch filename\n"
+			"       tc [-force] [-window N] -batch filename\n"
+			"       tc [-force] [-window N] -apply filename\n"
 #endif
 	                "where  OBJECT := { qdisc | class | filter | action | monitor }\n"
 	                "       OPTIONS := { -s[tatistics] | -d[etails] | -r[aw] | -p[retty] | -b[atch] [filename] }\n");
@@ -246,11 +273,35 @@ static int do_cmd(int argc, char **argv)
 }
 
 #ifndef ANDROID
+static const char *batch_name;
+static int batch_failed;
+
+static void batch_report(int lineno, int error, void *arg)
+{
+	fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+	fprintf(stderr, "Command failed %s:%d\n", batch_name, lineno);
+	batch_failed = 1;
+}
+
+/* Commands bail out with exit() on bad arguments; make sure the
+ * lines queued before that still reach the kernel.
+ */
+static void batch_exit(void)
+{
+	if (rth.batch)
+		rtnl_batch_flush(&rth);
+}
+
+/* With a window, every tc object may pipeline: modifications only talk
+ * to the kernel through rth, and show, get and monitor drain the window
+ * before they read anything.
+ */
 static int batch(const char *name)
 {
 	char *line = NULL;
 	size_t len = 0;
 	int ret = 0;
+	struct rtnl_batch_stats stats;
 
 	if (name && strcmp(name, "-") != 0) {
 		if (freopen(name, "r", stdin) == NULL) {
@@ -267,6 +318,18 @@ static int batch(const char *name)
 		return -1;
 	}
 
+	/* Device names are cached; follow renames and removals */
+	ll_map_watch();
+
+	batch_name = name;
+	if (batch_window > 1) {
+		if (rtnl_batch_start(&rth, batch_window, batch_report, NULL) < 0) {
+			rtnl_close(&rth);
+			return -1;
+		}
+		atexit(batch_exit);
+	}
+
 	cmdlineno = 0;
 	while (getcmdline(&line, &len, stdin) != -1) {
 		char *largv[100];
@@ -276,16 +339,31 @@ static int batch(const char *name)
 		if (largc == 0)
 			continue;	/* blank line */
 
+		ll_map_sync();
+
+		rtnl_batch_tag(&rth, cmdlineno);
 		if (do_cmd(largc, largv)) {
 			fprintf(stderr, "Command failed %s:%d\n", name, cmdlineno);
 			ret = 1;
 			if (!force)
 				break;
 		}
+		if (batch_failed && !force)
+			break;
 	}
 	if (line)
 		free(line);
 
+	if (rth.batch) {
+		if (rtnl_batch_flush(&rth) < 0)
+			ret = 1;
+		rtnl_batch_stop(&rth, &stats);
+		if (show_stats)
+			rtnl_batch_print_stats(stderr, &stats);
+	}
+	if (batch_failed)
+		ret = 1;
+
 	rtnl_close(&rth);
 	return ret;
 }
@@ -296,6 +374,7 @@ int main(int argc, char **argv)
 	int ret;
 #ifndef ANDROID
 	int do_batching = 0;
+	int do_apply = 0;
 	char *batchfile = NULL;
 #endif
 
@@ -327,6 +406,26 @@ int main(int argc, char **argv)
 			if (argc > 2)
 				batchfile = argv[2];
 			argc--;	argv++;
+		} else if (matches(argv[1], "-apply") == 0) {
+			if (argc <= 2) {
+				usage();
+				return -1;
+			}
+			do_apply = 1;
+			batchfile = argv[2];
+			argc--;	argv++;
+		} else if (matches(argv[1], "-window") == 0) {
+			if (argc <= 2) {
+				usage();
+				return -1;
+			}
+			if (get_integer(&batch_window, argv[2], 0) ||
+			    batch_window < 1) {
+				fprintf(stderr, "Invalid batch window '%s'\n",
+					argv[2]);
+				return -1;
+			}
+			argc--;	argv++;
 #endif
 		} else {
 			fprintf(stderr, "Option \"%s\" is unknown, try \"tc -help\".\n", argv[1]);
@@ -337,6 +436,8 @@ int main(int argc, char **argv)
 #ifndef ANDROID
 	if (do_batching)
 		return batch(batchfile);
+	if (do_apply)
+		return tc_apply(batchfile);
 #endif
 
 	if (argc <= 1) {
@@ -0,0 +1,1013 @@
+/*
+ * tc_apply.c		Bring qdiscs, classes and filters in line with a
+ *			configuration file, changing only what differs.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "tc_util.h"
+#include "tc_common.h"
+
+/* The file holds "qdisc", "class" and "filter" add/replace/change lines,
+ * parsed by the usual commands but captured instead of sent.  The
+ * objects already on the devices named in the file are dumped, and
+ * both sides are printed through the print_qopt/print_copt/print_fopt
+ * hooks of their kind; an object whose printed options match is left
+ * alone.  Everything else on those devices is deleted.
+ *
+ * Qdiscs are keyed by device and parent, classes by device and classid,
+ * and filters by device, parent, pref and protocol: all filters sharing
+ * a pref are compared, and replaced, as one group.
+ */
+#define APPLY_HASH	8192
+#define APPLY_WINDOW	64
+
+enum {
+	APPLY_KEEP,
+	APPLY_CHANGE,	/* options differ; changed in place */
+	APPLY_ADD,	/* new, or replaces what was there */
+	APPLY_GONE,	/* deleted, or replaced by the file's version */
+};
+
+struct apply_msg
+{
+	struct apply_msg	*next;
+	int			lineno;
+	struct nlmsghdr		n;	/* followed by the payload */
+};
+
+struct apply_obj
+{
+	struct apply_obj	*next;		/* in file or dump order */
+	struct apply_obj	*hnext;
+	struct apply_obj	*handle_next;	/* qdiscs, by handle */
+	int			type;		/* RTM_NEWQDISC, ... */
+	int			ifindex;
+	__u32			key;		/* parent or classid */
+	__u32			info;		/* filters: pref and protocol */
+	__u32			handle;
+	char			kind[16];
+	struct apply_msg	*msgs;		/* filters: every entry */
+	struct apply_msg	**tail;
+	struct apply_obj	*match;		/* counterpart in the other model */
+	char			*text;
+	int			nmsgs;
+	int			state;
+	int			depth;		/* classes: -1 until known */
+	int			changed;	/* qdiscs: changed already */
+};
+
+struct apply_model
+{
+	struct apply_obj	*head;
+	struct apply_obj	**tail;
+	struct apply_obj	*hash[APPLY_HASH];
+	struct apply_obj	*handles[APPLY_HASH];
+};
+
+static struct apply_model want, have;
+static const char *apply_name;
+static int apply_lineno;
+static int apply_captured;
+static int apply_failed;
+static int apply_probing;
+static int apply_probe_error;
+
+static struct {
+	int		unchanged;
+	int		changed;
+	int		added;
+	int		deleted;
+	int		failed;
+} apply_stats;
+
+static unsigned apply_hashfn(int type, int ifindex, __u32 key, __u32 info)
+{
+	__u32 h = type * 2654435761U;
+
+	h ^= ifindex * 40503U;
+	h ^= key * 2246822519U;
+	h ^= info * 3266489917U;
+	return (h ^ (h >> 15)) & (APPLY_HASH - 1);
+}
+
+static struct apply_obj *apply_find(struct apply_model *m, int type,
+				    int ifindex, __u32 key, __u32 info)
+{
+	struct apply_obj *o;
+
+	for (o = m->hash[apply_hashfn(type, ifindex, key, info)]; o; o = o->hnext)
+		if (o->type == type && o->ifindex == ifindex &&
+		    o->key == key && o->info == info)
+			return o;
+	return NULL;
+}
+
+static struct apply_obj *apply_get(struct apply_model *m, int type,
+				   int ifindex, __u32 key, __u32 info)
+{
+	struct apply_obj *o = apply_find(m, type, ifindex, key, info);
+	unsigned h;
+
+	if (o)
+		return o;
+
+	o = calloc(1, sizeof(*o));
+	if (o == NULL) {
+		perror("Cannot allocate apply state");
+		exit(1);
+	}
+	o->type = type;
+	o->ifindex = ifindex;
+	o->key = key;
+	o->info = info;
+	o->tail = &o->msgs;
+	o->depth = -1;
+
+	h = apply_hashfn(type, ifindex, key, info);
+	o->hnext = m->hash[h];
+	m->hash[h] = o;
+	if (m->tail == NULL)
+		m->tail = &m->head;
+	*m->tail = o;
+	m->tail = &o->next;
+	return o;
+}
+
+static void apply_index_handle(struct apply_model *m, struct apply_obj *o)
+{
+	unsigned h = apply_hashfn(0, o->ifindex, TC_H_MAJ(o->handle), 0);
+
+	o->handle_next = m->handles[h];
+	m->handles[h] = o;
+}
+
+/* The qdisc that owns classes and filters with this major */
+static struct apply_obj *apply_find_handle(struct apply_model *m,
+					   int ifindex, __u32 id)
+{
+	struct apply_obj *o;
+
+	id = TC_H_MAJ(id);
+	for (o = m->handles[apply_hashfn(0, ifindex, id, 0)]; o;
+	     o = o->handle_next)
+		if (o->ifindex == ifindex && TC_H_MAJ(o->handle) == id)
+			return o;
+	return NULL;
+}
+
+static void apply_add_msg(struct apply_obj *o, struct nlmsghdr *n, int lineno)
+{
+	struct apply_msg *m;
+
+	m = malloc(sizeof(*m) - sizeof(m->n) + n->nlmsg_len);
+	if (m == NULL) {
+		perror("Cannot allocate apply state");
+		exit(1);
+	}
+	m->next = NULL;
+	m->lineno = lineno;
+	memcpy(&m->n, n, n->nlmsg_len);
+	*o->tail = m;
+	o->tail = &m->next;
+	o->nmsgs++;
+}
+
+static const char *apply_kind(struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtattr *tb[TCA_MAX+1];
+
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*t)));
+	return tb[TCA_KIND] ? rta_getattr_str(tb[TCA_KIND]) : "";
+}
+
+/* Printed words that describe the kernel's state rather than the
+ * configuration: counters, and indexes the kernel hands out.  Each is
+ * dropped together with the "args" words after it.
+ */
+static const struct {
+	int		type;
+	const char	*kind;		/* NULL for any */
+	const char	*word;
+	int		args;
+} apply_noise[] = {
+	{ RTM_NEWQDISC,		"htb",	"direct_packets_stat",	1 },
+	{ RTM_NEWTFILTER,	NULL,	"index",		1 },
+	{ RTM_NEWTFILTER,	NULL,	"ref",			1 },
+	{ RTM_NEWTFILTER,	NULL,	"bind",			1 },
+};
+
+static char *apply_normalize(char *text, int type, const char *kind)
+{
+	char *out, *o, *word, *save = NULL;
+	char **words;
+	size_t len = strlen(text);
+	int nwords = 0, i, j;
+
+	/* words are separated, so there are at most half as many as bytes */
+	words = malloc((len / 2 + 1) * sizeof(*words));
+	out = o = malloc(len + 1);
+	if (words == NULL || out == NULL) {
+		perror("Cannot allocate apply state");
+		exit(1);
+	}
+	*o = 0;
+
+	for (word = strtok_r(text, " \t\n", &save); word;
+	     word = strtok_r(NULL, " \t\n", &save))
+		words[nwords++] = word;
+
+	for (i = 0; i < nwords; i++) {
+		for (j = 0; j < ARRAY_SIZE(apply_noise); j++) {
+			if (apply_noise[j].type == type &&
+			    (apply_noise[j].kind == NULL ||
+			     strcmp(apply_noise[j].kind, kind) == 0) &&
+			    strcmp(apply_noise[j].word, words[i]) == 0)
+				break;
+		}
+		if (j < ARRAY_SIZE(apply_noise)) {
+			i += apply_noise[j].args;
+			continue;
+		}
+
+		/* u32 keys in a table it created on its own */
+		if (strcmp(kind, "u32") == 0 && strcmp(words[i], "key") == 0 &&
+		    i + 4 < nwords && strcmp(words[i+1], "ht") == 0 &&
+		    strtoul(words[i+2], NULL, 16) >= 0x800) {
+			o += sprintf(o, "%s???", o == out ? "" : " ");
+			i += 4;
+			continue;
+		}
+		o += sprintf(o, "%s%s", o == out ? "" : " ", words[i]);
+	}
+	free(words);
+	return out;
+}
+
+/* Options of one object as its kind prints them */
+static char *apply_render(struct nlmsghdr *n, __u32 fhandle)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtattr *tb[TCA_MAX+1];
+	int saved_stats = show_stats;
+	int saved_details = show_details;
+	int saved_raw = show_raw;
+	const char *kind;
+	char *buf = NULL, *text;
+	size_t size = 0;
+	FILE *fp;
+
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*t)));
+	kind = tb[TCA_KIND] ? rta_getattr_str(tb[TCA_KIND]) : "";
+
+	fp = open_memstream(&buf, &size);
+	if (fp == NULL) {
+		perror("open_memstream");
+		exit(1);
+	}
+
+	show_stats = show_details = show_raw = 0;
+	if (tb[TCA_OPTIONS] && n->nlmsg_type == RTM_NEWTFILTER) {
+		struct filter_util *q = get_filter_kind(kind);
+
+		if (q)
+			q->print_fopt(q, fp, tb[TCA_OPTIONS], fhandle);
+	} else if (tb[TCA_OPTIONS]) {
+		struct qdisc_util *q;
+
+		if (strcmp(kind, "pfifo_fast") == 0)
+			q = get_qdisc_kind("prio");
+		else
+			q = get_qdisc_kind(kind);
+		if (q && n->nlmsg_type == RTM_NEWQDISC)
+			q->print_qopt(q, fp, tb[TCA_OPTIONS]);
+		else if (q && q->print_copt)
+			q->print_copt(q, fp, tb[TCA_OPTIONS]);
+	}
+	show_stats = saved_stats;
+	show_details = saved_details;
+	show_raw = saved_raw;
+	fclose(fp);
+
+	text = apply_normalize(buf, n->nlmsg_type, kind);
+	free(buf);
+	return text;
+}
+
+/* The entry a dump starts every pref with, and the hash table u32
+ * creates for every pref.
+ */
+static int apply_implicit(struct apply_msg *m, const char *text, int kernel)
+{
+	struct tcmsg *t = NLMSG_DATA(&m->n);
+
+	if (kernel && text[0] == 0)
+		return 1;
+	if (strcmp(text, "ht divisor 1") != 0)
+		return 0;
+	if (kernel)
+		return (t->tcm_handle >> 20) >= 0x800;
+	return t->tcm_handle == 0;
+}
+
+static int apply_cmp_text(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* All entries of a filter group, sorted, one per line.  Handles take
+ * part only if the file gives them.
+ */
+static char *apply_render_group(struct apply_obj *o, int handles, int kernel)
+{
+	char **texts;
+	char *text, *p;
+	struct apply_msg *m;
+	int n = 0, len = 1, i;
+
+	texts = calloc(o->nmsgs, sizeof(char *));
+	if (texts == NULL) {
+		perror("Cannot allocate apply state");
+		exit(1);
+	}
+	for (m = o->msgs; m; m = m->next) {
+		struct tcmsg *t = NLMSG_DATA(&m->n);
+		char *s = apply_render(&m->n, handles ? t->tcm_handle : 0);
+
+		if (apply_implicit(m, s, kernel)) {
+			free(s);
+			continue;
+		}
+		texts[n++] = s;
+		len += strlen(s) + 1;
+	}
+	qsort(texts, n, sizeof(char *), apply_cmp_text);
+
+	text = p = malloc(len);
+	if (text == NULL) {
+		perror("Cannot allocate apply state");
+		exit(1);
+	}
+	*p = 0;
+	for (i = 0; i < n; i++) {
+		p += sprintf(p, "%s\n", texts[i]);
+		free(texts[i]);
+	}
+	free(texts);
+	return text;
+}
+
+static int apply_same(struct apply_obj *w, struct apply_obj *h)
+{
+	const char *wt, *ht;
+
+	if (w->type == RTM_NEWTFILTER) {
+		struct apply_msg *m;
+		int handles = 0;
+
+		for (m = w->msgs; m; m = m->next)
+			if (((struct tcmsg *)NLMSG_DATA(&m->n))->tcm_handle)
+				handles = 1;
+		w->text = apply_render_group(w, handles, 0);
+		h->text = apply_render_group(h, handles, 1);
+		return strcmp(w->text, h->text) == 0;
+	}
+
+	if (strcmp(w->kind, h->kind) != 0)
+		return 0;
+	w->text = apply_render(&w->msgs->n, 0);
+	h->text = apply_render(&h->msgs->n, 0);
+	wt = w->text;
+	ht = h->text;
+
+	/* HTB prints the priority of leaf classes only */
+	if (w->type == RTM_NEWTCLASS && strcmp(w->kind, "htb") == 0 &&
+	    strncmp(wt, "prio ", 5) == 0 && strncmp(ht, "prio ", 5) != 0) {
+		wt = strchr(wt + 5, ' ');
+		wt = wt ? wt + 1 : "";
+	}
+	return strcmp(wt, ht) == 0;
+}
+
+static int apply_capture(const struct sockaddr_nl *who,
+			 struct nlmsghdr *n, void *arg)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct apply_obj *o;
+	__u32 key, info = 0;
+
+	if (n->nlmsg_type != RTM_NEWQDISC && n->nlmsg_type != RTM_NEWTCLASS &&
+	    n->nlmsg_type != RTM_NEWTFILTER) {
+		fprintf(stderr, "Only qdiscs, classes and filters can be applied\n");
+		return -1;
+	}
+	if (t->tcm_ifindex == 0) {
+		fprintf(stderr, "Applied objects need a device\n");
+		return -1;
+	}
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWQDISC:
+		key = t->tcm_parent;
+		break;
+	case RTM_NEWTCLASS:
+		key = t->tcm_handle;
+		if (key == 0) {
+			fprintf(stderr, "Applied classes need a classid\n");
+			return -1;
+		}
+		break;
+	default:
+		key = t->tcm_parent;
+		info = t->tcm_info;
+		if (TC_H_MAJ(info) == 0 || TC_H_MIN(info) == 0) {
+			fprintf(stderr, "Applied filters need a pref and a protocol\n");
+			return -1;
+		}
+		break;
+	}
+
+	apply_get(&want, RTM_NEWLINK, t->tcm_ifindex, 0, 0);
+	o = apply_get(&want, n->nlmsg_type, t->tcm_ifindex, key, info);
+	if (o->msgs && n->nlmsg_type != RTM_NEWTFILTER) {
+		fprintf(stderr, "Object given twice, first on line %d\n",
+			o->msgs->lineno);
+		return -1;
+	}
+	strncpy(o->kind, apply_kind(n), sizeof(o->kind) - 1);
+	o->handle = t->tcm_handle;
+	apply_add_msg(o, n, apply_lineno);
+	apply_captured++;
+	return 0;
+}
+
+static int apply_read(const char *name)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int ret = 0;
+
+	if (name && strcmp(name, "-") != 0) {
+		if (freopen(name, "r", stdin) == NULL) {
+			fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
+			return -1;
+		}
+	}
+
+	rth.capture = apply_capture;
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, stdin) != -1) {
+		char *largv[100];
+		int largc, err;
+		int captured = apply_captured;
+
+		largc = makeargs(line, largv, 100);
+		if (largc == 0)
+			continue;	/* blank line */
+
+		apply_lineno = cmdlineno;
+		if (matches(largv[0], "qdisc") == 0)
+			err = do_qdisc(largc-1, largv+1);
+		else if (matches(largv[0], "class") == 0)
+			err = do_class(largc-1, largv+1);
+		else if (matches(largv[0], "filter") == 0)
+			err = do_filter(largc-1, largv+1);
+		else {
+			fprintf(stderr, "Object \"%s\" cannot be applied\n",
+				largv[0]);
+			err = -1;
+		}
+		if (err == 0 && apply_captured != captured + 1) {
+			fprintf(stderr, "Only add, replace and change can be applied\n");
+			err = -1;
+		}
+		if (err) {
+			fprintf(stderr, "Command failed %s:%d\n", name, cmdlineno);
+			ret = -1;
+			break;
+		}
+	}
+	rth.capture = NULL;
+	free(line);
+	return ret;
+}
+
+static int apply_store(const struct sockaddr_nl *who,
+		       struct nlmsghdr *n, void *arg)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct apply_obj *o;
+	__u32 key, info = 0;
+
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*t)))
+		return 0;
+	if (!apply_find(&want, RTM_NEWLINK, t->tcm_ifindex, 0, 0))
+		return 0;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWQDISC:
+		key = t->tcm_parent;
+		break;
+	case RTM_NEWTCLASS:
+		key = t->tcm_handle;
+		break;
+	case RTM_NEWTFILTER:
+		key = t->tcm_parent;
+		info = t->tcm_info;
+		break;
+	default:
+		return 0;
+	}
+
+	o = apply_get(&have, n->nlmsg_type, t->tcm_ifindex, key, info);
+	if (o->msgs == NULL) {
+		strncpy(o->kind, apply_kind(n), sizeof(o->kind) - 1);
+		o->handle = t->tcm_handle;
+		if (n->nlmsg_type == RTM_NEWQDISC && o->handle)
+			apply_index_handle(&have, o);
+	}
+	apply_add_msg(o, n, 0);
+	return 0;
+}
+
+static int apply_dump(int type, int ifindex, __u32 parent)
+{
+	struct tcmsg t;
+
+	memset(&t, 0, sizeof(t));
+	t.tcm_family = AF_UNSPEC;
+	t.tcm_ifindex = ifindex;
+	t.tcm_parent = parent;
+
+	if (rtnl_dump_request(&rth, type, &t, sizeof(t)) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, apply_store, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int apply_dump_all(void)
+{
+	struct apply_obj *o;
+
+	if (apply_dump(RTM_GETQDISC, 0, 0) < 0)
+		return -1;
+	for (o = want.head; o; o = o->next)
+		if (o->type == RTM_NEWLINK &&
+		    apply_dump(RTM_GETTCLASS, o->ifindex, 0) < 0)
+			return -1;
+
+	/* Filters are listed per qdisc and per class */
+	for (o = have.head; o; o = o->next) {
+		if (o->type == RTM_NEWQDISC && o->handle == 0)
+			continue;
+		if (o->type != RTM_NEWQDISC && o->type != RTM_NEWTCLASS)
+			continue;
+		if (apply_dump(RTM_GETTFILTER, o->ifindex, o->handle) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Filters may be attached to "root"; the kernel reports the handle */
+static void apply_resolve_root(void)
+{
+	struct apply_obj *o, *q;
+
+	for (o = want.head; o; o = o->next) {
+		if (o->type != RTM_NEWTFILTER || o->key != TC_H_ROOT)
+			continue;
+		q = apply_find(&want, RTM_NEWQDISC, o->ifindex, TC_H_ROOT, 0);
+		if (q == NULL || q->handle == 0)
+			q = apply_find(&have, RTM_NEWQDISC, o->ifindex, TC_H_ROOT, 0);
+		if (q && q->handle) {
+			struct apply_msg *m;
+
+			for (m = o->msgs; m; m = m->next)
+				((struct tcmsg *)NLMSG_DATA(&m->n))->tcm_parent = q->handle;
+			o->key = q->handle;
+		}
+	}
+}
+
+static __u32 apply_parent(struct apply_obj *h)
+{
+	__u32 parent;
+
+	if (h->type != RTM_NEWTCLASS)
+		return h->key;
+
+	/* Top level classes are reported with the root as their parent */
+	parent = ((struct tcmsg *)NLMSG_DATA(&h->msgs->n))->tcm_parent;
+	if (parent == TC_H_ROOT)
+		parent = TC_H_MAJ(h->key);
+	return parent;
+}
+
+/* Deleting a qdisc takes everything below it along, and deleting a
+ * class takes its leaf qdisc; classes and filters under a class that
+ * goes must be deleted on their own.
+ */
+static int apply_covered(struct apply_obj *h)
+{
+	struct apply_obj *up;
+	__u32 parent = apply_parent(h);
+
+	if (parent == TC_H_ROOT || parent == TC_H_INGRESS ||
+	    TC_H_MAJ(parent) == 0)
+		return 0;
+
+	if (TC_H_MIN(parent)) {
+		up = apply_find(&have, RTM_NEWTCLASS, h->ifindex, parent, 0);
+		if (up && ((h->type == RTM_NEWQDISC && up->state == APPLY_GONE) ||
+			   apply_covered(up)))
+			return 1;
+	}
+	up = apply_find_handle(&have, h->ifindex, parent);
+	return up && up != h && (up->state == APPLY_GONE || apply_covered(up));
+}
+
+static int apply_survives(struct apply_obj *h)
+{
+	return h->state != APPLY_GONE && !apply_covered(h);
+}
+
+static int apply_class_depth(struct apply_obj *h)
+{
+	struct apply_obj *up;
+	__u32 parent = apply_parent(h);
+
+	if (h->depth >= 0)
+		return h->depth;
+	h->depth = 0;
+	if (TC_H_MIN(parent)) {
+		up = apply_find(&have, RTM_NEWTCLASS, h->ifindex, parent, 0);
+		if (up)
+			h->depth = apply_class_depth(up) + 1;
+	}
+	return h->depth;
+}
+
+static void apply_report(int tag, int error, void *arg)
+{
+	if (apply_probing) {
+		apply_probe_error = error;
+		return;
+	}
+	fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+	if (tag)
+		fprintf(stderr, "Command failed %s:%d\n", apply_name, tag);
+	else
+		fprintf(stderr, "Cannot remove an object %s does not list\n",
+			apply_name);
+	apply_stats.failed++;
+	apply_failed = 1;
+}
+
+/* With -s, every change is printed the way "tc monitor" would */
+static void apply_show(struct nlmsghdr *n)
+{
+	int saved_stats = show_stats;
+
+	show_stats = 0;
+	switch (n->nlmsg_type) {
+	case RTM_NEWQDISC:
+	case RTM_DELQDISC:
+		print_qdisc(NULL, n, stdout);
+		break;
+	case RTM_NEWTCLASS:
+	case RTM_DELTCLASS:
+		print_class(NULL, n, stdout);
+		break;
+	default:
+		print_filter(NULL, n, stdout);
+		break;
+	}
+	show_stats = saved_stats;
+}
+
+static void apply_send(struct nlmsghdr *n, int flags, int lineno)
+{
+	if (apply_failed && !force)
+		return;
+	n->nlmsg_flags = NLM_F_REQUEST | flags;
+	if (show_stats && n->nlmsg_type != RTM_DELTFILTER)
+		apply_show(n);
+	rtnl_batch_tag(&rth, lineno);
+	if (rtnl_talk(&rth, n, 0, 0, NULL) < 0)
+		apply_report(lineno, errno, NULL);
+}
+
+/* Not every qdisc can change its options in place.  The change is sent
+ * on its own and waited for, so that a refusal can be told apart from
+ * the other answers; returns 0 if the qdisc has to be rebuilt instead.
+ */
+static int apply_try_change(struct apply_obj *w)
+{
+	struct apply_msg *m = w->msgs;
+
+	((struct tcmsg *)NLMSG_DATA(&m->n))->tcm_handle = w->match->handle;
+	m->n.nlmsg_flags = NLM_F_REQUEST;
+
+	rtnl_batch_flush(&rth);
+	apply_probing = 1;
+	apply_probe_error = 0;
+	rtnl_batch_tag(&rth, m->lineno);
+	if (rtnl_talk(&rth, &m->n, 0, 0, NULL) < 0)
+		apply_probe_error = errno;
+	rtnl_batch_flush(&rth);
+	apply_probing = 0;
+
+	if (apply_probe_error == EINVAL || apply_probe_error == EOPNOTSUPP)
+		return 0;
+	if (apply_probe_error)
+		apply_report(m->lineno, apply_probe_error, NULL);
+	else if (show_stats)
+		apply_show(&m->n);
+	return 1;
+}
+
+static void apply_delete(struct apply_obj *h)
+{
+	struct nlmsghdr *n = &h->msgs->n;
+	int maxlen = n->nlmsg_len;
+	struct apply_msg *m;
+
+	/* The whole pref goes, not just its first entry */
+	if (h->type == RTM_NEWTFILTER) {
+		for (m = h->msgs; show_stats && m; m = m->next) {
+			m->n.nlmsg_type = RTM_DELTFILTER;
+			apply_show(&m->n);
+		}
+		((struct tcmsg *)NLMSG_DATA(n))->tcm_handle = 0;
+	}
+
+	n->nlmsg_type = h->type + 1;	/* RTM_DEL* follows RTM_NEW* */
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	addattr_l(n, maxlen, TCA_KIND, h->kind, strlen(h->kind) + 1);
+	apply_send(n, 0, 0);
+	apply_stats.deleted++;
+}
+
+static int apply_filter_early(struct apply_obj *h)
+{
+	struct apply_obj *up;
+
+	up = apply_find(&have, RTM_NEWTCLASS, h->ifindex, h->key, 0);
+	return up && up->match && up->state == APPLY_GONE;
+}
+
+static void apply_changes(void)
+{
+	struct apply_obj *w, *h;
+	struct apply_msg *m;
+	int depth, maxdepth = 0;
+
+	/* Qdiscs and classes that are there but not as the file wants
+	 * them are replaced; the objects below go along.
+	 */
+	for (w = want.head; w; w = w->next) {
+		if (w->type != RTM_NEWQDISC && w->type != RTM_NEWTCLASS)
+			continue;
+		h = apply_find(&have, w->type, w->ifindex, w->key, 0);
+		if (h == NULL) {
+			w->state = APPLY_ADD;
+			continue;
+		}
+		w->match = h;
+		h->match = w;
+		if (strcmp(w->kind, h->kind) != 0 ||
+		    (w->type == RTM_NEWQDISC &&
+		     (h->handle == 0 || (w->handle && w->handle != h->handle))) ||
+		    (w->type == RTM_NEWTCLASS &&
+		     apply_parent(w) != apply_parent(h))) {
+			w->state = APPLY_ADD;
+			h->state = APPLY_GONE;
+		}
+	}
+
+	/* and those it does not list are deleted, except for default
+	 * qdiscs and classes a qdisc creates on its own.
+	 */
+	for (h = have.head; h; h = h->next) {
+		if (h->match || h->type == RTM_NEWTFILTER)
+			continue;
+		if (h->type == RTM_NEWQDISC && h->handle == 0)
+			continue;
+		if (h->type == RTM_NEWTCLASS) {
+			struct qdisc_util *q = get_qdisc_kind(h->kind);
+
+			if (q == NULL || q->parse_copt == NULL)
+				continue;
+		}
+		h->state = APPLY_GONE;
+	}
+
+	for (w = want.head; w; w = w->next) {
+		if (w->type == RTM_NEWLINK || w->state == APPLY_ADD)
+			continue;
+		h = apply_find(&have, w->type, w->ifindex, w->key, w->info);
+		if (h == NULL || !apply_survives(h)) {
+			w->state = APPLY_ADD;
+			continue;
+		}
+		w->match = h;
+		h->match = w;
+		if (apply_same(w, h))
+			continue;
+		if (w->type == RTM_NEWTFILTER) {
+			w->state = APPLY_ADD;
+			h->state = APPLY_GONE;
+		} else
+			w->state = APPLY_CHANGE;
+	}
+
+	for (w = want.head; w; w = w->next) {
+		if (w->type != RTM_NEWQDISC || w->state != APPLY_CHANGE)
+			continue;
+		if (apply_try_change(w)) {
+			apply_stats.changed++;
+			w->state = APPLY_KEEP;
+			w->changed = 1;
+			continue;
+		}
+		w->state = APPLY_ADD;
+		w->match->state = APPLY_GONE;
+	}
+
+	/* What sat below a rebuilt qdisc has to be put back, and so
+	 * have the filters of a class that is deleted and added back.
+	 */
+	for (w = want.head; w; w = w->next) {
+		if (w->match == NULL || w->state == APPLY_ADD)
+			continue;
+		if (!apply_survives(w->match)) {
+			w->state = APPLY_ADD;
+		} else if (w->type == RTM_NEWTFILTER &&
+			   apply_filter_early(w->match)) {
+			w->state = APPLY_ADD;
+			w->match->state = APPLY_GONE;
+		}
+	}
+
+	/* Filters on a class that is deleted and added back go first, so
+	 * that the class can go; the others wait for the adds.
+	 */
+	for (h = have.head; h; h = h->next) {
+		if (h->type != RTM_NEWTFILTER)
+			continue;
+		if (h->match == NULL)
+			h->state = APPLY_GONE;
+		if (h->state == APPLY_GONE && !apply_covered(h) &&
+		    apply_filter_early(h))
+			apply_delete(h);
+	}
+
+	for (w = want.head; w; w = w->next) {
+		if (w->type != RTM_NEWQDISC && w->type != RTM_NEWTCLASS)
+			continue;
+		m = w->msgs;
+		h = w->match;
+		switch (w->state) {
+		case APPLY_KEEP:
+			if (!w->changed)
+				apply_stats.unchanged++;
+			break;
+		case APPLY_CHANGE:
+			apply_send(&m->n, 0, m->lineno);
+			apply_stats.changed++;
+			break;
+		default:
+			/* The REPLACE grafts the new qdisc in place of the
+			 * old one at once.  Only a new kind under the same
+			 * handle has to make room first: the kernel would
+			 * take that for a change, and refuse it.
+			 */
+			if (h && h->state == APPLY_GONE && !apply_covered(h) &&
+			    (w->type == RTM_NEWTCLASS ||
+			     (h->handle && h->handle == w->handle)))
+				apply_delete(h);
+			if (w->type == RTM_NEWQDISC) {
+				apply_send(&m->n, NLM_F_CREATE|NLM_F_REPLACE,
+					   m->lineno);
+			} else {
+				apply_send(&m->n, NLM_F_CREATE|NLM_F_EXCL,
+					   m->lineno);
+			}
+			apply_stats.added++;
+			break;
+		}
+	}
+
+	/* Nothing the file leaves out is deleted before the adds went
+	 * through; apply_send() stops after a failure unless -force.
+	 */
+	if (rtnl_batch_flush(&rth) < 0)
+		apply_failed = 1;
+
+	for (h = have.head; h; h = h->next) {
+		if (h->type == RTM_NEWTFILTER && h->state == APPLY_GONE &&
+		    !apply_covered(h) && !apply_filter_early(h))
+			apply_delete(h);
+	}
+
+	/* Classes nobody wants, leaves first, then qdiscs */
+	for (h = have.head; h; h = h->next) {
+		if (h->type != RTM_NEWTCLASS || h->match ||
+		    h->state != APPLY_GONE || apply_covered(h))
+			continue;
+		depth = apply_class_depth(h);
+		if (depth > maxdepth)
+			maxdepth = depth;
+	}
+	for (depth = maxdepth; depth >= 0; depth--) {
+		for (h = have.head; h; h = h->next) {
+			if (h->type != RTM_NEWTCLASS || h->match ||
+			    h->state != APPLY_GONE || apply_covered(h) ||
+			    apply_class_depth(h) != depth)
+				continue;
+			apply_delete(h);
+		}
+	}
+	for (h = have.head; h; h = h->next) {
+		if (h->type != RTM_NEWQDISC || h->match ||
+		    h->state != APPLY_GONE || apply_covered(h))
+			continue;
+		apply_delete(h);
+	}
+
+	for (w = want.head; w; w = w->next) {
+		if (w->type != RTM_NEWTFILTER)
+			continue;
+		if (w->state == APPLY_KEEP) {
+			apply_stats.unchanged++;
+			continue;
+		}
+		for (m = w->msgs; m; m = m->next)
+			apply_send(&m->n, NLM_F_CREATE|NLM_F_EXCL, m->lineno);
+		if (w->match)
+			apply_stats.changed++;
+		else
+			apply_stats.added++;
+	}
+}
+
+int tc_apply(const char *name)
+{
+	struct rtnl_batch_stats stats;
+	int window = batch_window > 1 ? batch_window : APPLY_WINDOW;
+	int ret = 0;
+
+	tc_core_init();
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+
+	apply_name = name;
+	if (apply_read(name) < 0 || apply_dump_all() < 0) {
+		rtnl_close(&rth);
+		return -1;
+	}
+	apply_resolve_root();
+
+	if (rtnl_batch_start(&rth, window, apply_report, NULL) < 0) {
+		rtnl_close(&rth);
+		return -1;
+	}
+	apply_changes();
+	if (rtnl_batch_flush(&rth) < 0)
+		ret = -1;
+	rtnl_batch_stop(&rth, &stats);
+
+	if (show_stats)
+		fprintf(stderr, "Apply: %d unchanged, %d changed, %d added, "
+			"%d deleted; %lu requests, %lu bytes, %d failed\n",
+			apply_stats.unchanged, apply_stats.changed,
+			apply_stats.added, apply_stats.deleted,
+			stats.requests, stats.bytes, apply_stats.failed);
+	if (apply_failed)
+		ret = 1;
+
+	rtnl_close(&rth);
+	return ret;
+}
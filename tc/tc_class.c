@@ -20,6 +20,8 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include "utils.h"
 #include "tc_util.h"
@@ -33,8 +35,10 @@ static void usage(void)
 	fprintf(stderr, "       [ classid CLASSID ] [ root | parent CLASSID ]\n");
 	fprintf(stderr, "       [ [ QDISC_KIND ] [ help | OPTIONS ] ]\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "       tc class show [ dev STRING ] [ root | parent CLASSID ]\n");
+	fprintf(stderr, "       tc class show [ dev DEVICES ] [ root | parent CLASSID ]\n");
+	fprintf(stderr, "       tc class watch dev DEVICES [ qdisc HANDLE ] [ interval SECS ] [ count N ]\n");
 	fprintf(stderr, "Where:\n");
+	fprintf(stderr, "DEVICES := { STRING | all | PATTERN }\n");
 	fprintf(stderr, "QDISC_KIND := { prio | cbq | etc. }\n");
 	fprintf(stderr, "OPTIONS := ... try tc class add <desired QDISC_KIND> help\n");
 	return;
@@ -130,8 +134,6 @@ int tc_class_modify(int cmd, unsigned flags, int argc, char **argv)
 	}
 
 	if (d[0])  {
-		ll_init_map(&rth);
-
 		if ((req.t.tcm_ifindex = ll_name_to_index(d)) == 0) {
 			fprintf(stderr, "Cannot find device \"%s\"\n", d);
 			return 1;
@@ -154,7 +156,7 @@ int print_class(const struct sockaddr_nl *who,
 	FILE *fp = (FILE*)arg;
 	struct tcmsg *t = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct rtattr * tb[TCA_MAX+1];
+	struct rtattr **tb;
 	struct qdisc_util *q;
 	char abuf[256];
 
@@ -173,8 +175,9 @@ int print_class(const struct sockaddr_nl *who,
 	if (filter_classid && t->tcm_handle != filter_classid)
 		return 0;
 
-	memset(tb, 0, sizeof(tb));
-	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	tb = tc_parse_tcmsg(t, len);
+	if (tb == NULL)
+		return -1;
 
 	if (tb[TCA_KIND] == NULL) {
 		fprintf(stderr, "print_class: NULL kind\n");
@@ -285,6 +288,13 @@ int tc_class_list(int argc, char **argv)
 
  	ll_init_map(&rth);
 
+	if (d[0] && tc_dev_is_pattern(d)) {
+		if (tc_dump_devices(&rth, d, RTM_GETTCLASS, &t,
+				    print_class, stdout) < 0)
+			return 1;
+		return 0;
+	}
+
 	if (d[0]) {
 		if ((t.tcm_ifindex = ll_name_to_index(d)) == 0) {
 			fprintf(stderr, "Cannot find device \"%s\"\n", d);
@@ -306,6 +316,279 @@ int tc_class_list(int argc, char **argv)
 	return 0;
 }
 
+/* "tc class watch" dumps the classes of a device every interval and
+ * prints a line for each class whose counters moved since the last
+ * dump, with the rates over the interval:
+ *
+ *	TIME dev DEV class ID bytes N packets N drops N overlimits N
+ *		backlog N qlen N [ bps N pps N ]
+ *
+ * New classes print without rates, and classes that went away print
+ * "deleted".  The last counters are kept by device and classid.
+ */
+#define WATCH_HASH	65536
+
+struct class_watch
+{
+	struct class_watch	*next;
+	int			ifindex;
+	__u32			classid;
+	unsigned		round;
+	__u64			bytes;
+	__u32			packets;
+	__u32			drops;
+	__u32			overlimits;
+	__u32			backlog;
+	__u32			qlen;
+};
+
+static struct class_watch *watch_hash[WATCH_HASH];
+static struct rtattr_table watch_table;
+static unsigned watch_round;
+static struct timeval watch_now;
+static double watch_elapsed;
+
+static struct class_watch **watch_slot(int ifindex, __u32 classid)
+{
+	unsigned h = (classid * 0x9e3779b1U) ^ (ifindex * 0x85ebca6bU);
+
+	return &watch_hash[(h >> 16) & (WATCH_HASH - 1)];
+}
+
+static void watch_head(FILE *fp, int ifindex, __u32 classid)
+{
+	char abuf[64];
+
+	print_tc_classid(abuf, sizeof(abuf), classid);
+	fprintf(fp, "%lu.%06lu dev %s class %s",
+		(unsigned long)watch_now.tv_sec,
+		(unsigned long)watch_now.tv_usec,
+		ll_index_to_name(ifindex), abuf);
+}
+
+static int watch_class(const struct sockaddr_nl *who,
+		       struct nlmsghdr *n, void *arg)
+{
+	FILE *fp = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct class_watch *w, **slot;
+	struct class_watch cur;
+	int fresh = 0;
+
+	if (n->nlmsg_type != RTM_NEWTCLASS || len < 0)
+		return 0;
+	if (filter_qdisc && TC_H_MAJ(t->tcm_handle^filter_qdisc))
+		return 0;
+
+	memset(&cur, 0, sizeof(cur));
+	rtattr_table_parse(&watch_table, TCA_RTA(t), len);
+	if (watch_table.tb[TCA_STATS2]) {
+		struct rtattr *tbs[TCA_STATS_MAX + 1];
+
+		parse_rtattr_nested(tbs, TCA_STATS_MAX, watch_table.tb[TCA_STATS2]);
+		if (tbs[TCA_STATS_BASIC]) {
+			struct gnet_stats_basic bs = {0};
+
+			memcpy(&bs, RTA_DATA(tbs[TCA_STATS_BASIC]),
+			       MIN(RTA_PAYLOAD(tbs[TCA_STATS_BASIC]), sizeof(bs)));
+			cur.bytes = bs.bytes;
+			cur.packets = bs.packets;
+		}
+		if (tbs[TCA_STATS_QUEUE]) {
+			struct gnet_stats_queue q = {0};
+
+			memcpy(&q, RTA_DATA(tbs[TCA_STATS_QUEUE]),
+			       MIN(RTA_PAYLOAD(tbs[TCA_STATS_QUEUE]), sizeof(q)));
+			cur.drops = q.drops;
+			cur.overlimits = q.overlimits;
+			cur.backlog = q.backlog;
+			cur.qlen = q.qlen;
+		}
+	} else if (watch_table.tb[TCA_STATS]) {
+		struct tc_stats st;
+
+		memset(&st, 0, sizeof(st));
+		memcpy(&st, RTA_DATA(watch_table.tb[TCA_STATS]),
+		       MIN(RTA_PAYLOAD(watch_table.tb[TCA_STATS]), sizeof(st)));
+		cur.bytes = st.bytes;
+		cur.packets = st.packets;
+		cur.drops = st.drops;
+		cur.overlimits = st.overlimits;
+		cur.backlog = st.backlog;
+		cur.qlen = st.qlen;
+	}
+
+	slot = watch_slot(t->tcm_ifindex, t->tcm_handle);
+	for (w = *slot; w; w = w->next) {
+		if (w->ifindex == t->tcm_ifindex && w->classid == t->tcm_handle)
+			break;
+	}
+	if (w == NULL) {
+		w = malloc(sizeof(*w));
+		if (w == NULL) {
+			perror("Cannot allocate class");
+			return -1;
+		}
+		cur.ifindex = t->tcm_ifindex;
+		cur.classid = t->tcm_handle;
+		cur.next = *slot;
+		*slot = w;
+		fresh = 1;
+	} else {
+		cur.ifindex = w->ifindex;
+		cur.classid = w->classid;
+		cur.next = w->next;
+		if (cur.bytes == w->bytes && cur.packets == w->packets &&
+		    cur.drops == w->drops && cur.overlimits == w->overlimits &&
+		    cur.backlog == w->backlog && cur.qlen == w->qlen) {
+			w->round = watch_round;
+			return 0;
+		}
+	}
+
+	watch_head(fp, cur.ifindex, cur.classid);
+	fprintf(fp, " bytes %llu packets %u drops %u overlimits %u"
+		" backlog %u qlen %u", (unsigned long long)cur.bytes,
+		cur.packets, cur.drops, cur.overlimits, cur.backlog, cur.qlen);
+	if (!fresh && watch_elapsed > 0)
+		fprintf(fp, " bps %.0f pps %.0f",
+			(cur.bytes - w->bytes) * 8 / watch_elapsed,
+			(__u32)(cur.packets - w->packets) / watch_elapsed);
+	fprintf(fp, "\n");
+
+	*w = cur;
+	w->round = watch_round;
+	return 0;
+}
+
+static void watch_sweep(FILE *fp)
+{
+	struct class_watch **wp, *w;
+	int i;
+
+	for (i = 0; i < WATCH_HASH; i++) {
+		for (wp = &watch_hash[i]; (w = *wp) != NULL; ) {
+			if (w->round == watch_round) {
+				wp = &w->next;
+				continue;
+			}
+			watch_head(fp, w->ifindex, w->classid);
+			fprintf(fp, " deleted\n");
+			*wp = w->next;
+			free(w);
+		}
+	}
+}
+
+static int tc_class_watch(int argc, char **argv)
+{
+	struct tcmsg t;
+	struct timeval last, tv;
+	double interval = 1, next, now;
+	unsigned count = 0;
+	char d[16];
+
+	memset(&t, 0, sizeof(t));
+	t.tcm_family = AF_UNSPEC;
+	memset(d, 0, sizeof(d));
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (d[0])
+				duparg("dev", *argv);
+			strncpy(d, *argv, sizeof(d)-1);
+		} else if (strcmp(*argv, "qdisc") == 0) {
+			NEXT_ARG();
+			if (filter_qdisc)
+				duparg("qdisc", *argv);
+			if (get_qdisc_handle(&filter_qdisc, *argv))
+				invarg(*argv, "invalid qdisc ID");
+		} else if (strcmp(*argv, "interval") == 0) {
+			char *end;
+
+			NEXT_ARG();
+			interval = strtod(*argv, &end);
+			if (*end || interval <= 0)
+				invarg(*argv, "invalid interval");
+		} else if (strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0))
+				invarg(*argv, "invalid count");
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+			return 0;
+		} else {
+			fprintf(stderr, "What is \"%s\"? Try \"tc class help\".\n", *argv);
+			return -1;
+		}
+		argc--; argv++;
+	}
+
+	if (d[0] == 0) {
+		fprintf(stderr, "\"watch\" needs a device\n");
+		return -1;
+	}
+	ll_init_map(&rth);
+	if (tc_dev_is_pattern(d)) {
+		/* Follow devices coming and going between rounds */
+		if (ll_map_watch() < 0)
+			return 1;
+	} else if ((t.tcm_ifindex = ll_name_to_index(d)) == 0) {
+		fprintf(stderr, "Cannot find device \"%s\"\n", d);
+		return 1;
+	}
+
+	if (rtattr_table_init(&watch_table, TCA_MAX) < 0) {
+		perror("Cannot allocate attribute table");
+		return 1;
+	}
+	rtattr_table_skip(&watch_table, TCA_OPTIONS);
+	rtattr_table_skip(&watch_table, TCA_XSTATS);
+
+	gettimeofday(&last, NULL);
+	next = last.tv_sec + last.tv_usec / 1000000.;
+	for (;;) {
+		gettimeofday(&watch_now, NULL);
+		watch_elapsed = (watch_now.tv_sec - last.tv_sec) +
+			(watch_now.tv_usec - last.tv_usec) / 1000000.;
+		last = watch_now;
+		watch_round++;
+
+		if (tc_dev_is_pattern(d)) {
+			ll_map_sync();
+			ll_init_map(&rth);
+			if (tc_dump_devices(&rth, d, RTM_GETTCLASS, &t,
+					    watch_class, stdout) < 0)
+				return 1;
+		} else {
+			if (rtnl_dump_request(&rth, RTM_GETTCLASS, &t, sizeof(t)) < 0) {
+				perror("Cannot send dump request");
+				return 1;
+			}
+			if (rtnl_dump_filter(&rth, watch_class, stdout) < 0) {
+				fprintf(stderr, "Dump terminated\n");
+				return 1;
+			}
+		}
+		watch_sweep(stdout);
+		fflush(stdout);
+
+		if (count && watch_round >= count)
+			break;
+
+		/* Keep to the schedule, skipping ticks a slow dump missed */
+		gettimeofday(&tv, NULL);
+		now = tv.tv_sec + tv.tv_usec / 1000000.;
+		next += interval;
+		if (next < now)
+			next += ceil((now - next) / interval) * interval;
+		usleep((next - now) * 1000000);
+	}
+	return 0;
+}
+
 int do_class(int argc, char **argv)
 {
 	if (argc < 1)
@@ -325,6 +608,8 @@ int do_class(int argc, char **argv)
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
 	    || matches(*argv, "lst") == 0)
 		return tc_class_list(argc-1, argv+1);
+	if (matches(*argv, "watch") == 0)
+		return tc_class_watch(argc-1, argv+1);
 	if (matches(*argv, "help") == 0) {
 		usage();
 		return 0;
@@ -106,14 +106,65 @@ unsigned tc_adjust_size(unsigned sz, unsigned mpu, enum link_layer linklayer)
    rtab[pkt_len>>cell_log] = pkt_xmit_time
  */
 
+/* A batch of classes uses a handful of rates over and over, and every
+ * table costs 256 divisions; the last few tables are kept.
+ */
+#define RTAB_CACHE	16
+
+struct rtab_cache_entry
+{
+	unsigned		rate;
+	unsigned		mpu;
+	int			cell_log;
+	enum link_layer		linklayer;
+	int			valid;
+	__u32			rtab[256];
+};
+
+static struct rtab_cache_entry rtab_cache[RTAB_CACHE];
+static int rtab_cache_next;
+
+/* Sizes first, then the times, in two flat loops the compiler can
+ * turn into vector code.  The results are those of
+ * tc_calc_xmittime(bps, tc_adjust_size(...)); going through __u64
+ * keeps times that do not fit in 32 bits the same as well.
+ */
+static void tc_fill_rtable(__u32 *rtab, unsigned bps, unsigned mpu,
+			   int cell_log, enum link_layer linklayer)
+{
+	double sz[256];
+	__u32 t;
+	int i;
+
+	if (linklayer == LINKLAYER_ATM) {
+		for (i = 0; i < 256; i++)
+			sz[i] = tc_adjust_size((i + 1) << cell_log, mpu,
+					       linklayer);
+	} else {
+		for (i = 0; i < 256; i++) {
+			unsigned s = (i + 1) << cell_log;
+
+			sz[i] = s < mpu ? mpu : s;
+		}
+	}
+
+	for (i = 0; i < 256; i++)
+		sz[i] = TIME_UNITS_PER_SEC * (sz[i] / bps);
+
+	for (i = 0; i < 256; i++) {
+		t = (__u64)sz[i];
+		rtab[i] = (__u64)(t * tick_in_usec);
+	}
+}
+
 int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
 		   int cell_log, unsigned mtu,
 		   enum link_layer linklayer)
 {
-	int i;
-	unsigned sz;
+	struct rtab_cache_entry *c;
 	unsigned bps = r->rate;
 	unsigned mpu = r->mpu;
+	int i;
 
 	if (mtu == 0)
 		mtu = 2047;
@@ -124,13 +175,30 @@ int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
 			cell_log++;
 	}
 
-	for (i=0; i<256; i++) {
-		sz = tc_adjust_size((i + 1) << cell_log, mpu, linklayer);
-		rtab[i] = tc_calc_xmittime(bps, sz);
+	if (linklayer != LINKLAYER_ATM)
+		linklayer = LINKLAYER_ETHERNET;
+
+	for (i = 0; i < RTAB_CACHE; i++) {
+		c = &rtab_cache[i];
+		if (c->valid && c->rate == bps && c->mpu == mpu &&
+		    c->cell_log == cell_log && c->linklayer == linklayer)
+			goto found;
 	}
 
+	c = &rtab_cache[rtab_cache_next];
+	rtab_cache_next = (rtab_cache_next + 1) % RTAB_CACHE;
+	c->rate = bps;
+	c->mpu = mpu;
+	c->cell_log = cell_log;
+	c->linklayer = linklayer;
+	c->valid = 1;
+	tc_fill_rtable(c->rtab, bps, mpu, cell_log, linklayer);
+found:
+	memcpy(rtab, c->rtab, sizeof(c->rtab));
+
 	r->cell_align=-1; // Due to the sz calc
 	r->cell_log=cell_log;
+	r->linklayer = (linklayer & TC_LINKLAYER_MASK);
 	return cell_log;
 }
 
@@ -207,5 +275,8 @@ int tc_core_init()
 
 	clock_factor  = (double)clock_res / TIME_UNITS_PER_SEC;
 	tick_in_usec = (double)t2us / us2t * clock_factor;
+
+	/* The tables depend on the tick */
+	memset(rtab_cache, 0, sizeof(rtab_cache));
 	return 0;
 }
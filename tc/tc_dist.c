@@ -0,0 +1,136 @@
+/*
+ * tc_dist.c		Distribution tables for netem.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/types.h>
+
+#include "tc_dist.h"
+
+/* A batch adding many netem qdiscs asks for the same few tables over
+ * and over, so each table is parsed once and kept for the life of the
+ * process.  The file is checked with stat() on every use, and read
+ * again when it has been changed.
+ */
+struct dist_cache
+{
+	struct dist_cache	*next;
+	char			name[128];
+	dev_t			dev;
+	ino_t			ino;
+	off_t			size;
+	time_t			mtime;
+	int			n;
+	__s16			data[0];
+};
+
+static struct dist_cache *dist_cache;
+
+/*
+ * Simplistic file parser for distrbution data.
+ * Format is:
+ *	# comment line(s)
+ *	data0 data1 ...
+ */
+static int dist_read(FILE *f, const char *name, __s16 *data, int maxdata)
+{
+	int n = 0;
+	long x;
+	size_t len;
+	char *line = NULL;
+
+	while (getline(&line, &len, f) != -1) {
+		char *p, *endp;
+		if (*line == '\n' || *line == '#')
+			continue;
+
+		for (p = line; ; p = endp) {
+			x = strtol(p, &endp, 0);
+			if (endp == p)
+				break;
+
+			if (n >= maxdata) {
+				fprintf(stderr, "%s: too much data\n",
+					name);
+				n = -1;
+				goto error;
+			}
+			data[n++] = x;
+		}
+	}
+ error:
+	free(line);
+	return n;
+}
+
+const __s16 *tc_get_distribution(const char *dir, const char *type,
+				 int maxdata, int *size)
+{
+	struct dist_cache *d, **dp;
+	struct stat st;
+	char name[128];
+	FILE *f;
+
+	snprintf(name, sizeof(name), "%s/%s.dist", dir, type);
+	if (stat(name, &st) == 0) {
+		for (dp = &dist_cache; (d = *dp) != NULL; dp = &d->next) {
+			if (strcmp(d->name, name) != 0)
+				continue;
+			if (d->dev == st.st_dev && d->ino == st.st_ino &&
+			    d->size == st.st_size && d->mtime == st.st_mtime &&
+			    d->n <= maxdata) {
+				/* Keep the tables in use at the front */
+				*dp = d->next;
+				d->next = dist_cache;
+				dist_cache = d;
+				*size = d->n;
+				return d->data;
+			}
+			*dp = d->next;
+			free(d);
+			break;
+		}
+	}
+
+	if ((f = fopen(name, "r")) == NULL || fstat(fileno(f), &st) < 0) {
+		fprintf(stderr, "No distribution data for %s (%s: %s)\n",
+			type, name, strerror(errno));
+		if (f)
+			fclose(f);
+		return NULL;
+	}
+
+	d = malloc(sizeof(*d) + maxdata * sizeof(d->data[0]));
+	if (d == NULL) {
+		perror("Cannot allocate distribution");
+		fclose(f);
+		return NULL;
+	}
+	d->n = dist_read(f, name, d->data, maxdata);
+	fclose(f);
+	if (d->n <= 0) {
+		free(d);
+		return NULL;
+	}
+
+	strcpy(d->name, name);
+	d->dev = st.st_dev;
+	d->ino = st.st_ino;
+	d->size = st.st_size;
+	d->mtime = st.st_mtime;
+	d->next = dist_cache;
+	dist_cache = d;
+	*size = d->n;
+	return d->data;
+}
@@ -0,0 +1,7 @@
+#ifndef _TC_DIST_H_
+#define _TC_DIST_H_ 1
+
+extern const __s16 *tc_get_distribution(const char *dir, const char *type,
+					 int maxdata, int *size);
+
+#endif
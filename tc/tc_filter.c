@@ -36,8 +36,9 @@ static void usage(void)
 	fprintf(stderr, "       [ root | classid CLASSID ] [ handle FILTERID ]\n");
 	fprintf(stderr, "       [ [ FILTER_TYPE ] [ help | OPTIONS ] ]\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "       tc filter show [ dev STRING ] [ root | parent CLASSID ]\n");
+	fprintf(stderr, "       tc filter show [ dev DEVICES ] [ root | parent CLASSID ]\n");
 	fprintf(stderr, "Where:\n");
+	fprintf(stderr, "DEVICES := { STRING | all | PATTERN }\n");
 	fprintf(stderr, "FILTER_TYPE := { rsvp | u32 | fw | route | etc. }\n");
 	fprintf(stderr, "FILTERID := ... format depends on classifier, see there\n");
 	fprintf(stderr, "OPTIONS := ... try tc filter add <desired FILTER_KIND> help\n");
@@ -135,6 +136,14 @@ int tc_filter_modify(int cmd, unsigned flags, int argc, char **argv)
 
 	req.t.tcm_info = TC_H_MAKE(prio<<16, protocol);
 
+	/* Before the options: some filters send requests of their own */
+	if (d[0])  {
+		if ((req.t.tcm_ifindex = ll_name_to_index(d)) == 0) {
+			fprintf(stderr, "Cannot find device \"%s\"\n", d);
+			return 1;
+		}
+	}
+
 	if (k[0])
 		addattr_l(&req.n, sizeof(req), TCA_KIND, k, strlen(k)+1);
 
@@ -157,16 +166,6 @@ int tc_filter_modify(int cmd, unsigned flags, int argc, char **argv)
 	if (est.ewma_log)
 		addattr_l(&req.n, sizeof(req), TCA_RATE, &est, sizeof(est));
 
-
-	if (d[0])  {
- 		ll_init_map(&rth);
-
-		if ((req.t.tcm_ifindex = ll_name_to_index(d)) == 0) {
-			fprintf(stderr, "Cannot find device \"%s\"\n", d);
-			return 1;
-		}
-	}
-
 	if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0) {
 		fprintf(stderr, "We have an error talking to the kernel\n");
 		return 2;
@@ -188,7 +187,7 @@ int print_filter(const struct sockaddr_nl *who,
 	FILE *fp = (FILE*)arg;
 	struct tcmsg *t = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct rtattr * tb[TCA_MAX+1];
+	struct rtattr **tb;
 	struct filter_util *q;
 	char abuf[256];
 
@@ -202,8 +201,9 @@ int print_filter(const struct sockaddr_nl *who,
 		return -1;
 	}
 
-	memset(tb, 0, sizeof(tb));
-	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	tb = tc_parse_tcmsg(t, len);
+	if (tb == NULL)
+		return -1;
 
 	if (tb[TCA_KIND] == NULL) {
 		fprintf(stderr, "print_filter: NULL kind\n");
@@ -328,6 +328,13 @@ int tc_filter_list(int argc, char **argv)
 
  	ll_init_map(&rth);
 
+	if (d[0] && tc_dev_is_pattern(d)) {
+		if (tc_dump_devices(&rth, d, RTM_GETTFILTER, &t,
+				    print_filter, stdout) < 0)
+			return 1;
+		return 0;
+	}
+
 	if (d[0]) {
 		if ((t.tcm_ifindex = ll_name_to_index(d)) == 0) {
 			fprintf(stderr, "Cannot find device \"%s\"\n", d);
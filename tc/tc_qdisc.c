@@ -19,6 +19,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <fnmatch.h>
 #include <math.h>
 #include <malloc.h>
 
@@ -36,8 +37,9 @@ static int usage(void)
 	fprintf(stderr, "       [ stab [ help | STAB_OPTIONS] ]\n");
 	fprintf(stderr, "       [ [ QDISC_KIND ] [ help | OPTIONS ] ]\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "       tc qdisc show [ dev STRING ] [ingress]\n");
+	fprintf(stderr, "       tc qdisc show [ dev DEVICES ] [ingress]\n");
 	fprintf(stderr, "Where:\n");
+	fprintf(stderr, "DEVICES := { STRING | all | PATTERN }\n");
 	fprintf(stderr, "QDISC_KIND := { [p|b]fifo | tbf | prio | cbq | red | etc. }\n");
 	fprintf(stderr, "OPTIONS := ... try tc qdisc add <desired QDISC_KIND> help\n");
 	fprintf(stderr, "STAB_OPTIONS := ... try tc qdisc add stab help\n");
@@ -177,8 +179,6 @@ int tc_qdisc_modify(int cmd, unsigned flags, int argc, char **argv)
 	if (d[0])  {
 		int idx;
 
- 		ll_init_map(&rth);
-
 		if ((idx = ll_name_to_index(d)) == 0) {
 			fprintf(stderr, "Cannot find device \"%s\"\n", d);
 			return 1;
@@ -193,6 +193,7 @@ int tc_qdisc_modify(int cmd, unsigned flags, int argc, char **argv)
 }
 
 static int filter_ifindex;
+static const char *filter_pattern;
 
 int print_qdisc(const struct sockaddr_nl *who,
 		       struct nlmsghdr *n,
@@ -201,7 +202,7 @@ int print_qdisc(const struct sockaddr_nl *who,
 	FILE *fp = (FILE*)arg;
 	struct tcmsg *t = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct rtattr * tb[TCA_MAX+1];
+	struct rtattr **tb;
 	struct qdisc_util *q;
 	char abuf[256];
 
@@ -217,9 +218,13 @@ int print_qdisc(const struct sockaddr_nl *who,
 
 	if (filter_ifindex && filter_ifindex != t->tcm_ifindex)
 		return 0;
+	if (filter_pattern &&
+	    fnmatch(filter_pattern, ll_index_to_name(t->tcm_ifindex), 0) != 0)
+		return 0;
 
-	memset(tb, 0, sizeof(tb));
-	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	tb = tc_parse_tcmsg(t, len);
+	if (tb == NULL)
+		return -1;
 
 	if (tb[TCA_KIND] == NULL) {
 		fprintf(stderr, "print_qdisc: NULL kind\n");
@@ -310,7 +315,11 @@ int tc_qdisc_list(int argc, char **argv)
 
  	ll_init_map(&rth);
 
-	if (d[0]) {
+	/* One dump covers every device, so a pattern is matched here */
+	if (d[0] && tc_dev_is_pattern(d)) {
+		if (strcmp(d, "all") != 0)
+			filter_pattern = d;
+	} else if (d[0]) {
 		if ((t.tcm_ifindex = ll_name_to_index(d)) == 0) {
 			fprintf(stderr, "Cannot find device \"%s\"\n", d);
 			return 1;
@@ -551,3 +551,69 @@ compat_xstats:
 		*xstats = tb[TCA_XSTATS];
 }
 
+/* The qdisc, class and filter printers parse every message of a dump
+ * into one table.  Statistics are only entered with -s and the size
+ * table only with -d, as nothing else looks at them.
+ */
+static struct rtattr_table tc_table;
+
+struct rtattr **tc_parse_tcmsg(struct tcmsg *t, int len)
+{
+	if (tc_table.tb == NULL) {
+		if (rtattr_table_init(&tc_table, TCA_MAX) < 0) {
+			perror("Cannot allocate attribute table");
+			return NULL;
+		}
+		if (!show_stats) {
+			rtattr_table_skip(&tc_table, TCA_STATS);
+			rtattr_table_skip(&tc_table, TCA_STATS2);
+			rtattr_table_skip(&tc_table, TCA_XSTATS);
+		}
+		if (!show_details)
+			rtattr_table_skip(&tc_table, TCA_STAB);
+	}
+	rtattr_table_parse(&tc_table, TCA_RTA(t), len);
+	return tc_table.tb;
+}
+
+/* A "dev" argument names several devices when it is "all" or a shell
+ * pattern such as "eth*".
+ */
+int tc_dev_is_pattern(const char *dev)
+{
+	return strcmp(dev, "all") == 0 || strpbrk(dev, "*?[") != NULL;
+}
+
+/* Dump "type" for every device matching "dev", in ifindex order.  The
+ * kernel runs one dump per socket at a time, so the devices are done
+ * one after the other over the same handle.  Needs the link map.
+ */
+int tc_dump_devices(struct rtnl_handle *rth, const char *dev, int type,
+		    struct tcmsg *t, rtnl_filter_t filter, void *arg)
+{
+	int *list;
+	int i, n, err = 0;
+
+	n = ll_index_list(strcmp(dev, "all") ? dev : NULL, &list);
+	if (n < 0) {
+		perror("Cannot allocate device list");
+		return -1;
+	}
+	if (n == 0 && strcmp(dev, "all") != 0) {
+		fprintf(stderr, "Cannot find device \"%s\"\n", dev);
+		err = -1;
+	}
+
+	for (i = 0; i < n && !err; i++) {
+		t->tcm_ifindex = list[i];
+		if (rtnl_dump_request(rth, type, t, sizeof(*t)) < 0) {
+			perror("Cannot send dump request");
+			err = -1;
+		} else if (rtnl_dump_filter(rth, filter, arg) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			err = -1;
+		}
+	}
+	free(list);
+	return err;
+}
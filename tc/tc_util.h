@@ -82,6 +82,10 @@ extern char * sprint_linklayer(unsigned linklayer, char *buf);
 
 extern void print_tcstats_attr(FILE *fp, struct rtattr *tb[], char *prefix, struct rtattr **xstats);
 extern void print_tcstats2_attr(FILE *fp, struct rtattr *rta, char *prefix, struct rtattr **xstats);
+extern struct rtattr **tc_parse_tcmsg(struct tcmsg *t, int len);
+extern int tc_dev_is_pattern(const char *dev);
+extern int tc_dump_devices(struct rtnl_handle *rth, const char *dev, int type,
+			   struct tcmsg *t, rtnl_filter_t filter, void *arg);
 
 extern int get_tc_classid(__u32 *h, const char *str);
 extern int print_tc_classid(char *buf, int len, __u32 h);
@@ -0,0 +1,82 @@
+/*
+ * dist_bench.c	Time loading netem distribution tables.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Usage:	dist_bench [TABLE [LOADS]]
+ *
+ * "parse" loads LOADS different copies of TABLE, so every load reads
+ * and parses a file, as each tc process does.  "cached" loads the same
+ * table LOADS times, as a batch of netem qdiscs does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <linux/types.h>
+
+#include "tc_dist.h"
+
+#define MAX_DIST	(16*1024)
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	const char *table = argc > 1 ? argv[1] : "../../netem/normal.dist";
+	long loads = argc > 2 ? atol(argv[2]) : 1000;
+	char dir[] = "/tmp/dist_benchXXXXXX";
+	char name[64], cmd[512];
+	const __s16 *data;
+	double start, parse, cached;
+	int size = 0;
+	long k;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	for (k = 0; k < loads; k++) {
+		snprintf(cmd, sizeof(cmd), "cp %s %s/d%ld.dist", table, dir, k);
+		if (system(cmd) != 0) {
+			fprintf(stderr, "Cannot copy %s\n", table);
+			return 1;
+		}
+	}
+
+	start = now();
+	for (k = 0; k < loads; k++) {
+		snprintf(name, sizeof(name), "d%ld", k);
+		if (tc_get_distribution(dir, name, MAX_DIST, &size) == NULL)
+			return 1;
+	}
+	parse = now() - start;
+
+	start = now();
+	for (k = 0; k < loads; k++) {
+		data = tc_get_distribution(dir, "d0", MAX_DIST, &size);
+		if (data == NULL)
+			return 1;
+	}
+	cached = now() - start;
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd) != 0)
+		fprintf(stderr, "Cannot remove %s\n", dir);
+
+	printf("%d values per table\n", size);
+	printf("%-10s %10.1f us/load\n", "parse", parse * 1e6 / loads);
+	printf("%-10s %10.1f us/load\n", "cached", cached * 1e6 / loads);
+	return 0;
+}
@@ -0,0 +1,383 @@
+/*
+ * dump_bench.c	Replay synthetic netlink dumps through the ip printers.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Usage:	dump_bench [ -l LINKS ] [ -r ROUTES ] [ -n NEIGHS ]
+ *			   [ -s ] [ -d ] [ -o ] [ -w DIR ]
+ *
+ * The links, routes and neighbours are built the way a 3.x kernel dumps
+ * them and fed through rtnl_from_file() and accept_msg(), i.e. exactly
+ * the path of "ip monitor file", with the output going to /dev/null.
+ * Links go first so that the interface map is warm for the others.
+ * -w also saves the streams, in the format "ip monitor file" reads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netdevice.h>
+#include <linux/if_arp.h>
+#include <linux/if_link.h>
+#include <linux/neighbour.h>
+
+#include "utils.h"
+#include "ll_map.h"
+#include "ip_common.h"
+
+/* What ip.c would provide */
+int preferred_family = AF_UNSPEC;
+int show_stats = 0;
+int show_details = 0;
+int resolve_hosts = 0;
+int oneline = 0;
+int timestamp = 0;
+char * _SL_ = NULL;
+char *batch_file = NULL;
+int force = 0;
+int max_flush_loops = 10;
+int batch_window = 1;
+int dump_jobs = 1;
+struct rtnl_handle rth = { .fd = -1 };
+
+extern int accept_msg(const struct sockaddr_nl *who,
+		      struct nlmsghdr *n, void *arg);
+
+/* Every allocation in the process, libc's own included, is counted */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long alloc_calls;
+static unsigned long long alloc_bytes;
+
+void *malloc(size_t size)
+{
+	alloc_calls++;
+	alloc_bytes += size;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	alloc_calls++;
+	alloc_bytes += n * size;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	alloc_calls++;
+	alloc_bytes += size;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#endif
+
+struct stream
+{
+	const char	*name;
+	unsigned	count;
+	void		(*build)(struct nlmsghdr *n, unsigned i);
+	char		*buf;
+	size_t		len;
+};
+
+static unsigned nlinks = 100000;
+
+static void build_link(struct nlmsghdr *n, unsigned i)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtnl_link_stats64 st64;
+	struct rtnl_link_stats st;
+	struct rtnl_link_ifmap map;
+	unsigned char addr[6] = { 0x02, 0, i >> 24, i >> 16, i >> 8, i };
+	unsigned char brd[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	char name[IFNAMSIZ];
+
+	n->nlmsg_type = RTM_NEWLINK;
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_type = ARPHRD_ETHER;
+	ifi->ifi_index = i + 1;
+	ifi->ifi_flags = IFF_UP|IFF_BROADCAST|IFF_MULTICAST|IFF_RUNNING|IFF_LOWER_UP;
+
+	memset(&st64, 0, sizeof(st64));
+	memset(&st, 0, sizeof(st));
+	memset(&map, 0, sizeof(map));
+	st64.rx_packets = st.rx_packets = i * 13;
+	st64.tx_packets = st.tx_packets = i * 7;
+	st64.rx_bytes = st.rx_bytes = i * 1500ULL;
+	st64.tx_bytes = st.tx_bytes = i * 700ULL;
+	snprintf(name, sizeof(name), "bench%u", i);
+
+	addattr_l(n, 1024, IFLA_IFNAME, name, strlen(name) + 1);
+	addattr32(n, 1024, IFLA_TXQLEN, 1000);
+	addattr8(n, 1024, IFLA_OPERSTATE, IF_OPER_UP);
+	addattr8(n, 1024, IFLA_LINKMODE, 0);
+	addattr32(n, 1024, IFLA_MTU, 1500);
+	addattr32(n, 1024, IFLA_GROUP, 0);
+	addattr_l(n, 1024, IFLA_QDISC, "noqueue", 8);
+	addattr_l(n, 1024, IFLA_MAP, &map, sizeof(map));
+	addattr_l(n, 1024, IFLA_ADDRESS, addr, sizeof(addr));
+	addattr_l(n, 1024, IFLA_BROADCAST, brd, sizeof(brd));
+	addattr_l(n, 1024, IFLA_STATS64, &st64, sizeof(st64));
+	addattr_l(n, 1024, IFLA_STATS, &st, sizeof(st));
+}
+
+/* A mix of connected /24s, gatewayed /24s and host routes */
+static void build_route(struct nlmsghdr *n, unsigned i)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	__u32 dst, gw;
+
+	n->nlmsg_type = RTM_NEWROUTE;
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(*r));
+	r->rtm_family = AF_INET;
+	r->rtm_table = RT_TABLE_MAIN;
+	r->rtm_type = RTN_UNICAST;
+
+	switch (i % 4) {
+	case 0:
+		r->rtm_dst_len = 24;
+		r->rtm_protocol = RTPROT_KERNEL;
+		r->rtm_scope = RT_SCOPE_LINK;
+		dst = htonl(((10 + (i >> 16)) << 24) | ((i & 0xffff) << 8));
+		break;
+	case 3:
+		r->rtm_dst_len = 32;
+		r->rtm_protocol = RTPROT_STATIC;
+		r->rtm_scope = RT_SCOPE_UNIVERSE;
+		dst = htonl((200 << 24) | i);
+		break;
+	default:
+		r->rtm_dst_len = 24;
+		r->rtm_protocol = RTPROT_BOOT;
+		r->rtm_scope = RT_SCOPE_UNIVERSE;
+		dst = htonl(((100 + (i >> 16)) << 24) | ((i & 0xffff) << 8));
+		break;
+	}
+
+	addattr32(n, 1024, RTA_TABLE, RT_TABLE_MAIN);
+	addattr_l(n, 1024, RTA_DST, &dst, sizeof(dst));
+	if (r->rtm_scope == RT_SCOPE_UNIVERSE) {
+		gw = htonl(0x0a000001 | ((i % nlinks) << 8));
+		addattr_l(n, 1024, RTA_GATEWAY, &gw, sizeof(gw));
+	}
+	if (i % 8 == 3)
+		addattr32(n, 1024, RTA_PRIORITY, 100 + i % 16);
+	addattr32(n, 1024, RTA_OIF, i % nlinks + 1);
+}
+
+static void build_neigh(struct nlmsghdr *n, unsigned i)
+{
+	static const __u16 states[] = {
+		NUD_REACHABLE, NUD_STALE, NUD_PERMANENT, NUD_DELAY,
+	};
+	struct ndmsg *ndm = NLMSG_DATA(n);
+	struct nda_cacheinfo ci;
+	unsigned char lladdr[6] = { 0x02, 0x01, i >> 24, i >> 16, i >> 8, i };
+	__u32 dst = htonl(0x0a000000 | ((i % nlinks) << 8) | (2 + i / nlinks % 250));
+
+	n->nlmsg_type = RTM_NEWNEIGH;
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(*ndm));
+	ndm->ndm_family = AF_INET;
+	ndm->ndm_ifindex = i % nlinks + 1;
+	ndm->ndm_state = states[i % 4];
+	ndm->ndm_type = RTN_UNICAST;
+
+	memset(&ci, 0, sizeof(ci));
+	ci.ndm_confirmed = i % 30000;
+	ci.ndm_used = i % 20000;
+	ci.ndm_updated = i % 40000;
+	ci.ndm_refcnt = i % 3;
+
+	addattr_l(n, 1024, NDA_DST, &dst, sizeof(dst));
+	addattr_l(n, 1024, NDA_LLADDR, lladdr, sizeof(lladdr));
+	addattr_l(n, 1024, NDA_CACHEINFO, &ci, sizeof(ci));
+	addattr32(n, 1024, NDA_PROBES, 0);
+}
+
+static int stream_build(struct stream *s)
+{
+	FILE *fp;
+	unsigned i;
+
+	fp = open_memstream(&s->buf, &s->len);
+	if (fp == NULL) {
+		perror("open_memstream");
+		return -1;
+	}
+	for (i = 0; i < s->count; i++) {
+		struct {
+			struct nlmsghdr	n;
+			char		buf[1024];
+		} req;
+
+		memset(&req, 0, sizeof(req));
+		req.n.nlmsg_flags = NLM_F_MULTI;
+		req.n.nlmsg_seq = 1;
+		s->build(&req.n, i);
+		fwrite(&req, 1, NLMSG_ALIGN(req.n.nlmsg_len), fp);
+	}
+	if (fclose(fp)) {
+		perror("Cannot build stream");
+		return -1;
+	}
+	return 0;
+}
+
+static int stream_save(struct stream *s, const char *dir)
+{
+	char path[1024];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s.nl", dir, s->name);
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+	fwrite(s->buf, 1, s->len, fp);
+	if (fclose(fp)) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	fprintf(stderr,
+"Usage: dump_bench [ -l LINKS ] [ -r ROUTES ] [ -n NEIGHS ] [ -s ] [ -d ] [ -o ]\n"
+"                  [ -w DIR ]\n");
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct stream streams[] = {
+		{ "link", 100000, build_link },
+		{ "route", 1000000, build_route },
+		{ "neigh", 1000000, build_neigh },
+	};
+	int nstreams = sizeof(streams) / sizeof(streams[0]);
+	const char *dir = NULL;
+	FILE *report, *null;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "l:r:n:sdow:")) != -1) {
+		switch (opt) {
+		case 'l':
+			streams[0].count = atoi(optarg);
+			break;
+		case 'r':
+			streams[1].count = atoi(optarg);
+			break;
+		case 'n':
+			streams[2].count = atoi(optarg);
+			break;
+		case 's':
+			++show_stats;
+			break;
+		case 'd':
+			++show_details;
+			break;
+		case 'o':
+			++oneline;
+			break;
+		case 'w':
+			dir = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	_SL_ = oneline ? "\\" : "\n";
+	nlinks = streams[0].count ? streams[0].count : 1;
+
+	/* The report keeps the real stdout; the printers get /dev/null */
+	report = fdopen(dup(STDOUT_FILENO), "w");
+	null = freopen("/dev/null", "w", stdout);
+	if (report == NULL || null == NULL) {
+		perror("Cannot redirect output");
+		return 1;
+	}
+
+	ipaddr_reset_filter(oneline);
+	iproute_reset_filter();
+	ipneigh_reset_filter();
+
+	fprintf(report, "%-6s %9s %10s %8s %12s %12s %10s\n",
+		"stream", "messages", "bytes", "seconds", "msgs/s",
+		"allocs", "alloc MB");
+
+	for (i = 0; i < nstreams; i++) {
+		struct stream *s = &streams[i];
+		unsigned long calls = 0;
+		unsigned long long bytes = 0;
+		double start, secs;
+		FILE *fp;
+
+		if (s->count == 0)
+			continue;
+		if (stream_build(s) < 0)
+			return 1;
+		if (dir && stream_save(s, dir) < 0)
+			return 1;
+
+		fp = fmemopen(s->buf, s->len, "r");
+		if (fp == NULL) {
+			perror("fmemopen");
+			return 1;
+		}
+
+#ifdef __GLIBC__
+		calls = alloc_calls;
+		bytes = alloc_bytes;
+#endif
+		start = now();
+		if (rtnl_from_file(fp, accept_msg, stdout) < 0) {
+			fprintf(stderr, "Replay of %s failed\n", s->name);
+			return 1;
+		}
+		fflush(stdout);
+		secs = now() - start;
+#ifdef __GLIBC__
+		calls = alloc_calls - calls;
+		bytes = alloc_bytes - bytes;
+#endif
+		fclose(fp);
+
+		fprintf(report, "%-6s %9u %10zu %8.3f %12.0f %12lu %10.1f\n",
+			s->name, s->count, s->len, secs,
+			secs > 0 ? s->count / secs : 0, calls, bytes / 1e6);
+		free(s->buf);
+	}
+	fclose(report);
+	return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * parse_bench.c	Compare parse_rtattr() with rtattr_table_parse().
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Usage:	parse_bench [ITERATIONS]
+ *
+ * Each case builds one message the way the kernel fills it and parses
+ * it over and over; the table is reused, as the printers do in a dump.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/if_link.h>
+
+#include "libnetlink.h"
+
+#define ROUNDS	5
+
+struct bench_case
+{
+	const char	*name;
+	int		max;
+	int		hdrlen;
+	int		types[48];
+	int		lens[48];
+};
+
+/* A route, a link and a neighbour with the attributes a 3.x kernel sends */
+static struct bench_case cases[] = {
+	{ "route", RTA_MAX, sizeof(struct rtmsg),
+	  { RTA_TABLE, RTA_DST, RTA_PRIORITY, RTA_PREFSRC, RTA_OIF, -1 },
+	  { 4, 4, 4, 4, 4 } },
+	{ "route6", RTA_MAX, sizeof(struct rtmsg),
+	  { RTA_TABLE, RTA_DST, RTA_PRIORITY, RTA_OIF, RTA_CACHEINFO, -1 },
+	  { 4, 16, 4, 4, sizeof(struct rta_cacheinfo) } },
+	{ "link", IFLA_MAX, sizeof(struct ifinfomsg),
+	  { IFLA_IFNAME, IFLA_TXQLEN, IFLA_OPERSTATE, IFLA_LINKMODE, IFLA_MTU,
+	    IFLA_GROUP, IFLA_QDISC, IFLA_MAP, IFLA_ADDRESS, IFLA_BROADCAST,
+	    IFLA_STATS64, IFLA_STATS, IFLA_AF_SPEC, -1 },
+	  { 16, 4, 1, 1, 4, 4, 8, sizeof(struct rtnl_link_ifmap), 6, 6,
+	    sizeof(struct rtnl_link_stats64), sizeof(struct rtnl_link_stats),
+	    200 } },
+	{ "neigh", NDA_MAX, sizeof(struct ndmsg),
+	  { NDA_DST, NDA_LLADDR, NDA_PROBES, NDA_CACHEINFO, -1 },
+	  { 4, 6, 4, sizeof(struct nda_cacheinfo) } },
+	/* A wide table of which a message uses a few low types */
+	{ "wide", 255, sizeof(struct tcmsg),
+	  { 1, 2, 3, -1 },
+	  { 8, 4, 16 } },
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int build(struct bench_case *c, char *buf, int size)
+{
+	struct nlmsghdr *n = (struct nlmsghdr *)buf;
+	char data[512];
+	int i;
+
+	memset(buf, 0, size);
+	memset(data, 0x5a, sizeof(data));
+	n->nlmsg_len = NLMSG_LENGTH(c->hdrlen);
+	for (i = 0; c->types[i] >= 0; i++)
+		addattr_l(n, size, c->types[i], data, c->lens[i]);
+	return n->nlmsg_len - NLMSG_LENGTH(c->hdrlen);
+}
+
+int main(int argc, char **argv)
+{
+	long iters = argc > 1 ? atol(argv[1]) : 2000000;
+	int i;
+
+	printf("%-8s %4s %6s %14s %14s %14s\n",
+	       "case", "max", "attrs", "parse_rtattr", "table", "table+minlen");
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		struct bench_case *c = &cases[i];
+		struct rtattr_table t, p;
+		struct rtattr *tb[c->max + 1];
+		struct rtattr *rta;
+		char buf[4096];
+		volatile unsigned long sink = 0;
+		double start, old, new, pol;
+		int len, nattrs, round;
+		long k;
+
+		len = build(c, buf, sizeof(buf));
+		rta = (struct rtattr *)(buf + NLMSG_LENGTH(c->hdrlen));
+		for (nattrs = 0; c->types[nattrs] >= 0; nattrs++)
+			;
+
+		memset(&t, 0, sizeof(t));
+		if (rtattr_table_init(&t, c->max) < 0) {
+			perror("rtattr_table_init");
+			return 1;
+		}
+		memset(&p, 0, sizeof(p));
+		if (rtattr_table_init(&p, c->max) < 0) {
+			perror("rtattr_table_init");
+			return 1;
+		}
+		for (k = 0; k < nattrs; k++)
+			rtattr_table_minlen(&p, c->types[k], c->lens[k]);
+
+		/* Best of a few alternating rounds, to keep noise out */
+		old = new = pol = 1e9;
+		for (round = 0; round < ROUNDS; round++) {
+			double d;
+
+			start = now();
+			for (k = 0; k < iters; k++) {
+				parse_rtattr(tb, c->max, rta, len);
+				sink += (unsigned long)tb[c->types[k % nattrs]];
+			}
+			d = now() - start;
+			if (d < old)
+				old = d;
+
+			start = now();
+			for (k = 0; k < iters; k++) {
+				rtattr_table_parse(&t, rta, len);
+				sink += (unsigned long)t.tb[c->types[k % nattrs]];
+			}
+			d = now() - start;
+			if (d < new)
+				new = d;
+
+			start = now();
+			for (k = 0; k < iters; k++) {
+				rtattr_table_parse(&p, rta, len);
+				sink += (unsigned long)p.tb[c->types[k % nattrs]];
+			}
+			d = now() - start;
+			if (d < pol)
+				pol = d;
+		}
+		rtattr_table_free(&t);
+		rtattr_table_free(&p);
+
+		printf("%-8s %4d %6d %11.1f ns %11.1f ns %11.1f ns\n",
+		       c->name, c->max, nattrs, old * 1e9 / iters,
+		       new * 1e9 / iters, pol * 1e9 / iters);
+	}
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * rtab_bench.c	Time tc_calc_rtable() and check it against the plain loop.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Usage:	rtab_bench [TABLES]
+ *
+ * "distinct" asks for a new rate every time, so it times the table
+ * fill; "8 rates" cycles through a few rates, as a batch of classes
+ * does.  "loop" is the per-entry loop tc_calc_rtable() used to run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tc_core.h"
+
+#define ROUNDS	5
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int loop_rtable(struct tc_ratespec *r, __u32 *rtab,
+		       int cell_log, unsigned mtu, enum link_layer linklayer)
+{
+	int i;
+
+	if (mtu == 0)
+		mtu = 2047;
+	if (cell_log < 0) {
+		cell_log = 0;
+		while ((mtu >> cell_log) > 255)
+			cell_log++;
+	}
+	for (i = 0; i < 256; i++)
+		rtab[i] = tc_calc_xmittime(r->rate,
+			tc_adjust_size((i + 1) << cell_log, r->mpu, linklayer));
+	return cell_log;
+}
+
+static int check(void)
+{
+	static const enum link_layer layers[] = {
+		LINKLAYER_UNSPEC, LINKLAYER_ETHERNET, LINKLAYER_ATM
+	};
+	static const unsigned mpus[] = { 0, 64, 1000 };
+	static const unsigned mtus[] = { 0, 1514, 9000, 65536 };
+	__u32 a[256], b[256];
+	unsigned rate;
+	int bad = 0, l, m, u;
+
+	for (rate = 8; rate < 4000000000U / 2; rate = rate * 3 / 2 + 7)
+	for (l = 0; l < 3; l++)
+	for (m = 0; m < 3; m++)
+	for (u = 0; u < 4; u++) {
+		struct tc_ratespec r = { .rate = rate, .mpu = mpus[m] };
+
+		if (loop_rtable(&r, a, -1, mtus[u], layers[l]) !=
+		    tc_calc_rtable(&r, b, -1, mtus[u], layers[l]) ||
+		    memcmp(a, b, sizeof(a)) != 0) {
+			fprintf(stderr, "mismatch: rate %u mpu %u mtu %u layer %d\n",
+				rate, mpus[m], mtus[u], layers[l]);
+			bad++;
+		}
+	}
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	long tables = argc > 1 ? atol(argv[1]) : 200000;
+	double loop = 1e9, fill = 1e9, hit = 1e9, start, d;
+	volatile __u32 sink = 0;
+	__u32 rtab[256];
+	int round;
+	long k;
+
+	if (tc_core_init() < 0)
+		fprintf(stderr, "No /proc/net/psched, using a tick of 1us\n");
+
+	if (check())
+		return 1;
+
+	for (round = 0; round < ROUNDS; round++) {
+		struct tc_ratespec r = { .mpu = 64 };
+
+		start = now();
+		for (k = 0; k < tables; k++) {
+			r.rate = 125000 + k;
+			loop_rtable(&r, rtab, -1, 1600, LINKLAYER_ETHERNET);
+			sink += rtab[k & 255];
+		}
+		d = now() - start;
+		if (d < loop)
+			loop = d;
+
+		start = now();
+		for (k = 0; k < tables; k++) {
+			r.rate = 125000 + k;
+			tc_calc_rtable(&r, rtab, -1, 1600, LINKLAYER_ETHERNET);
+			sink += rtab[k & 255];
+		}
+		d = now() - start;
+		if (d < fill)
+			fill = d;
+
+		start = now();
+		for (k = 0; k < tables; k++) {
+			r.rate = 125000 * (1 + (k & 7));
+			tc_calc_rtable(&r, rtab, -1, 1600, LINKLAYER_ETHERNET);
+			sink += rtab[k & 255];
+		}
+		d = now() - start;
+		if (d < hit)
+			hit = d;
+	}
+
+	printf("%-10s %10.1f ns/table\n", "loop", loop * 1e9 / tables);
+	printf("%-10s %10.1f ns/table\n", "distinct", fill * 1e9 / tables);
+	printf("%-10s %10.1f ns/table\n", "8 rates", hit * 1e9 / tables);
+	return 0;
+}